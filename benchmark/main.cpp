@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2023-2025 Mathieu Carbou
+ */
+// Host benchmark of the scheduler, built with the native env:
+//
+//   PLATFORMIO_SRC_DIR=benchmark pio run -e native -t exec
+//
+// The task manager runs on Mycila::VirtualClock: the schedule (which task runs at which pass) is the same on every run
+// and on every machine, so the run counts printed are reproducible. The costs are measured with the host clock.
+#include <MycilaTaskManager.h>
+
+#include <stdio.h>
+
+#include <chrono>
+#include <vector>
+
+static volatile uint32_t sink = 0;
+
+static void work(void*) { sink = sink + 1; }
+
+static std::vector<Mycila::Task*> tasks;
+
+// nanoseconds since the previous call
+static double lap() {
+  static auto last = std::chrono::steady_clock::now();
+  auto now = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(now - last).count();
+  last = now;
+  return ns;
+}
+
+// adds count tasks of the given interval to the task manager: interval 0 means a different interval for each task
+static void addTasks(Mycila::TaskManager& taskManager, size_t count, uint32_t intervalMillis) {
+  for (size_t i = 0; i < count; i++) {
+    Mycila::Task* task = new Mycila::Task("bench", work);
+    task->setInterval(intervalMillis ? intervalMillis : 1 + i % 100);
+    task->setEnabled(true);
+    taskManager.addTask(*task);
+    tasks.push_back(task);
+  }
+}
+
+static void clearTasks(Mycila::TaskManager& taskManager) {
+  for (Mycila::Task* task : tasks) {
+    taskManager.removeTask(*task);
+    delete task;
+  }
+  tasks.clear();
+}
+
+static const char* schedulerName(Mycila::TaskManager::Scheduler scheduler) {
+  return scheduler == Mycila::TaskManager::Scheduler::DEADLINE ? "DEADLINE" : "LINEAR";
+}
+
+static void benchRecord() {
+  const uint32_t count = 1000000;
+  Mycila::BinStatistics stats(10);
+  uint32_t value = 1;
+  lap();
+  for (uint32_t i = 0; i < count; i++) {
+    // values spread over all the bins
+    value = value * 1103515245 + 12345;
+    stats.record(value >> (value & 31));
+  }
+  double ns = lap();
+  printf("BinStatistics::record()        %8.1f ns/call (%" PRIu32 " records)\n", ns / count, stats.count());
+}
+
+static void benchTryRun() {
+  const uint32_t count = 1000000;
+  Mycila::Task task("bench", work);
+  task.setEnabled(true);
+
+  // not due: the cost paid by each task at each pass
+  task.setInterval(1000);
+  task.tryRun();
+  lap();
+  for (uint32_t i = 0; i < count; i++)
+    task.tryRun();
+  double notDue = lap();
+
+  // always due: polling and running an empty function
+  task.setIntervalMicros(0);
+  sink = 0;
+  lap();
+  for (uint32_t i = 0; i < count; i++)
+    task.tryRun();
+  double due = lap();
+
+  printf("Task::tryRun() not due         %8.1f ns/call\n", notDue / count);
+  printf("Task::tryRun() due             %8.1f ns/call (%" PRIu32 " runs)\n", due / count, sink);
+}
+
+// a pass where no task is due
+static void benchIdle(Mycila::TaskManager::Scheduler scheduler, size_t taskCount) {
+  const uint32_t passes = 100000;
+  Mycila::TaskManager taskManager("bench");
+  taskManager.setScheduler(scheduler);
+  addTasks(taskManager, taskCount, 60000);
+  // first runs
+  taskManager.loop();
+  lap();
+  for (uint32_t i = 0; i < passes; i++)
+    taskManager.loop();
+  double ns = lap();
+  printf("idle      %-8s %5zu tasks  %10.1f ns/pass\n", schedulerName(scheduler), taskCount, ns / passes);
+  clearTasks(taskManager);
+}
+
+// a pass where every task is due
+static void benchDue(Mycila::TaskManager::Scheduler scheduler, size_t taskCount) {
+  const uint32_t passes = 1000000 / taskCount;
+  Mycila::TaskManager taskManager("bench");
+  taskManager.setScheduler(scheduler);
+  addTasks(taskManager, taskCount, 1);
+  size_t runs = 0;
+  lap();
+  for (uint32_t i = 0; i < passes; i++) {
+    Mycila::VirtualClock::advance(1000);
+    runs += taskManager.loop();
+  }
+  double ns = lap();
+  printf("due       %-8s %5zu tasks  %10.1f ns/pass  %6.1f ns/run  (%zu runs)\n", schedulerName(scheduler), taskCount, ns / passes, ns / runs, runs);
+  clearTasks(taskManager);
+}
+
+// intervals from 1 to 100 ms, the virtual clock moves by 1 ms between passes
+static void benchMixed(Mycila::TaskManager::Scheduler scheduler, size_t taskCount) {
+  const uint32_t passes = 10000;
+  Mycila::TaskManager taskManager("bench");
+  taskManager.setScheduler(scheduler);
+  addTasks(taskManager, taskCount, 0);
+  size_t runs = 0;
+  lap();
+  for (uint32_t i = 0; i < passes; i++) {
+    Mycila::VirtualClock::advance(1000);
+    runs += taskManager.loop();
+  }
+  double ns = lap();
+  printf("mixed     %-8s %5zu tasks  %10.1f ns/pass  %6.1f ns/run  (%zu runs)\n", schedulerName(scheduler), taskCount, ns / passes, ns / runs, runs);
+  clearTasks(taskManager);
+}
+
+// the queries of a UI or power manager: through the tasks, or from the schedule snapshot
+static void benchQueries(size_t taskCount) {
+  const uint32_t count = 100000;
+  Mycila::TaskManager taskManager("bench");
+  addTasks(taskManager, taskCount, 0);
+  taskManager.enableScheduleSnapshot();
+  taskManager.loop();
+  int64_t remaining = 0;
+  lap();
+  for (uint32_t i = 0; i < count; i++)
+    remaining += taskManager.remainingMicros();
+  double scan = lap();
+  for (uint32_t i = 0; i < count; i++)
+    remaining += taskManager.earliestDeadline();
+  double snapshot = lap();
+  size_t due = 0;
+  for (uint32_t i = 0; i < count; i++)
+    due += taskManager.dueWithin(10);
+  double window = lap();
+  sink = sink + static_cast<uint32_t>(remaining);
+  printf("queries            %5zu tasks  remainingMicros() %8.1f ns  earliestDeadline() %6.1f ns  dueWithin() %6.1f ns (%zu due)\n", taskCount, scan / count, snapshot / count, window / count, due / count);
+  clearTasks(taskManager);
+}
+
+int main() {
+  const size_t counts[] = {1, 10, 100, 1000};
+  const Mycila::TaskManager::Scheduler schedulers[] = {Mycila::TaskManager::Scheduler::LINEAR, Mycila::TaskManager::Scheduler::DEADLINE};
+
+  printf("MycilaTaskManager %s benchmark\n\n", MYCILA_TASK_MANAGER_VERSION);
+
+  benchRecord();
+  benchTryRun();
+  printf("\n");
+
+  for (auto scheduler : schedulers)
+    for (size_t count : counts)
+      benchIdle(scheduler, count);
+  printf("\n");
+
+  for (auto scheduler : schedulers)
+    for (size_t count : counts)
+      benchDue(scheduler, count);
+  printf("\n");
+
+  for (auto scheduler : schedulers)
+    for (size_t count : counts)
+      benchMixed(scheduler, count);
+  printf("\n");
+
+  for (size_t count : counts)
+    benchQueries(count);
+
+  return 0;
+}
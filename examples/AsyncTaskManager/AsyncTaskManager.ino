@@ -30,9 +30,10 @@ void setup() {
   sayGoodbye.onDone([](const Mycila::Task& me, uint32_t elapsed) {
     Serial.println("sayGoodbye DONE");
     ESP_LOGD("app", "Task '%s' executed in %" PRIu32 " us", me.name(), elapsed);
-    ping.setData(params);
-    ping.resume();
   });
+  // ping runs right after sayGoodbye, with its data
+  sayGoodbye.setData(params);
+  sayGoodbye.then(ping, true);
   sayGoodbye.setEnabled(true);
   loopTaskManager.addTask(sayGoodbye);
 
@@ -0,0 +1,47 @@
+#include <Arduino.h>
+#include <MycilaTaskManager.h>
+
+Mycila::TaskManager loopTaskManager("loop()");
+
+// a state machine which never blocks the task manager
+Mycila::Task blink("blink", [](void* params) {
+  static uint8_t count;
+  MYCILA_TASK_BEGIN(blink);
+  for (count = 0; count < 10; count++) {
+    Serial.println("ON");
+    MYCILA_TASK_SLEEP(blink, 500);
+    Serial.println("OFF");
+    MYCILA_TASK_SLEEP(blink, 500);
+  }
+  Serial.println("Waiting for a trigger...");
+  MYCILA_TASK_WAIT_TRIGGER(blink);
+  Serial.println("Triggered!");
+  MYCILA_TASK_END(blink);
+});
+
+Mycila::Task hello("hello", [](void* params) { Serial.println("Hello"); });
+
+Mycila::Task output("output", [](void* params) { loopTaskManager.log(); });
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial)
+    continue;
+
+  loopTaskManager.addTask(blink);
+
+  // keeps running while blink is sleeping
+  hello.setInterval(200);
+  loopTaskManager.addTask(hello);
+
+  output.setInterval(5000);
+  loopTaskManager.addTask(output);
+
+  loopTaskManager.enableProfiling(6);
+}
+
+void loop() {
+  loopTaskManager.loop();
+  if (millis() > 15000 && blink.paused())
+    blink.trigger();
+}
@@ -4,15 +4,29 @@
  */
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <new>
+
 #ifdef MYCILA_JSON_SUPPORT
   #include <ArduinoJson.h>
 #endif
 
+#ifndef MYCILA_BIN_STATISTICS_SUB_BINS
+  // linear sub-bins per bin used to estimate the percentiles: a power of 2, up to 32
+  #define MYCILA_BIN_STATISTICS_SUB_BINS 4
+#endif
+
 namespace Mycila {
   class BinStatistics {
     public:
+      enum class Unit {
+        MILLISECONDS,
+        MICROSECONDS
+      };
+
       // record the number of iterations in each bin.
       // bin sizing is bases on power of 2, so if binCount = 16, we will have 16 bins:
       // bin 0 : 0 <= elapsed < 2^1 (exception for lower bound)
@@ -22,59 +36,394 @@ namespace Mycila {
       // ...
       // bin 14 : 2^14 <= elapsed < 2^15
       // bin 15 : 2^15 <= elapsed (exception for upper bound)
+      // Each bin is also split in SUB_BINS linear sub-bins (like HdrHistogram) which are only used to estimate the percentiles.
       // The unit determines the unit of the elapsed time recorded in the bins.
       // It allows to be more precise depending on the expected task execution durations.
       // unitDivider is the divider to se for the unit: 1 for milliseconds, 1000 for seconds, etc
-      explicit BinStatistics(uint8_t binCount, uint32_t unitDivider = 1) : _binCount(binCount), _unitDivider(unitDivider) {
-        _bins = new uint16_t[binCount];
+      // unit is the unit of the elapsed time given to record(), before applying the divider.
+      explicit BinStatistics(uint8_t binCount, uint32_t unitDivider = 1, Unit unit = Unit::MILLISECONDS) : _binCount(binCount < MAX_BINS ? binCount : MAX_BINS), _unitDivider(unitDivider), _unit(unit) {
+        // a power of 2 divider is a shift
+        _unitShift = unitDivider <= 1 ? 0 : (unitDivider & (unitDivider - 1)) ? -1 : __builtin_ctz(unitDivider);
+        _bins = new std::atomic<Counter>[_binCount];
+        _subBins = new std::atomic<Counter>[_binCount * SUB_BINS];
         clear();
       }
 
-      ~BinStatistics() { delete[] _bins; }
+      ~BinStatistics() {
+        delete[] _bins;
+        delete[] _subBins;
+        delete _exported;
+      }
+
+      // maximum number of bins: elapsed times are 32 bits
+      static constexpr uint8_t MAX_BINS = 32;
+      // linear sub-bins in each bin
+      static constexpr uint8_t SUB_BINS = MYCILA_BIN_STATISTICS_SUB_BINS;
+      static_assert(SUB_BINS && SUB_BINS <= 32 && !(SUB_BINS & (SUB_BINS - 1)), "MYCILA_BIN_STATISTICS_SUB_BINS must be a power of 2, up to 32");
+
+      // Number of entries in a bin, which stops at its maximum.
+      // 16 bits by default to save memory, 32 bits with MYCILA_TASK_MANAGER_32BIT_BINS for statistics kept for a long time.
+#ifdef MYCILA_TASK_MANAGER_32BIT_BINS
+      typedef uint32_t Counter;
+#else
+      typedef uint16_t Counter;
+#endif
+
+      // consistent copy of the statistics, which can be taken from any task or core
+      // min, max, sum and percentiles are in the recorded unit, before applying the divider
+      struct Snapshot {
+          uint32_t count = 0;
+          uint32_t min = 0;
+          uint32_t max = 0;
+          uint64_t sum = 0;
+          uint32_t unitDivider = 1;
+          Unit unit = Unit::MILLISECONDS;
+          uint8_t binCount = 0;
+          Counter bins[MAX_BINS] = {0};
+          // SUB_BINS entries per bin, in the same order
+          Counter subBins[MAX_BINS * SUB_BINS] = {0};
+          // number of times the statistics were cleared
+          uint32_t clears = 0;
+
+          uint32_t mean() const { return count ? sum / count : 0; }
+
+          // Estimate the value below which p percent of the entries fall (p between 0 and 100),
+          // by linear interpolation inside the sub-bin, bounded by the min and max values.
+          // The estimate is off by at most the width of a sub-bin: 1 / SUB_BINS of the value (25% by default),
+          // or 2 / SUB_BINS times the unit divider in bin 0. Above the lower bound of the last bin, the sub-bins are only bounded by max.
+          uint32_t percentile(float p) const {
+            const size_t subBinCount = binCount * SUB_BINS;
+            uint32_t total = 0;
+            for (size_t i = 0; i < subBinCount; i++)
+              total += subBins[i];
+            if (!total)
+              return 0;
+            const float rank = p * total / 100;
+            uint32_t cumulative = 0;
+            for (size_t i = 0; i < subBinCount; i++) {
+              if (subBins[i] && cumulative + subBins[i] >= rank) {
+                const uint8_t bin = i / SUB_BINS;
+                const uint8_t sub = i % SUB_BINS;
+                // bin 0 holds 0 and 1 and bin n holds [2^n, 2^(n+1))
+                const float width = static_cast<float>(1ULL << (bin ? bin : 1)) / SUB_BINS;
+                const float lower = ((bin ? static_cast<float>(1ULL << bin) : 0) + width * sub) * unitDivider;
+                float upper = lower + width * unitDivider;
+                if (bin == binCount - 1 && sub == SUB_BINS - 1 && upper < max)
+                  upper = max;
+                float value = lower + (upper - lower) * (rank - cumulative) / subBins[i];
+                if (value < min)
+                  value = min;
+                if (value > max)
+                  value = max;
+                return value;
+              }
+              cumulative += subBins[i];
+            }
+            return max;
+          }
+
+#ifdef MYCILA_JSON_SUPPORT
+          void toJson(const JsonObject& root) const {
+            root["count"] = count;
+            root["unit_divider"] = unitDivider;
+            root["unit"] = unit == Unit::MICROSECONDS ? "us" : "ms";
+            root["min"] = min;
+            root["max"] = max;
+            root["mean"] = mean();
+            root["total"] = sum;
+            root["p50"] = percentile(50);
+            root["p95"] = percentile(95);
+            root["p99"] = percentile(99);
+            for (size_t i = 0; i < binCount; i++)
+              root["bins"][i] = bins[i];
+          }
+#endif
+      };
 
-      // unit divider in milliseconds
+      // unit divider in milliseconds, or microseconds
       uint32_t unitDivider() const { return _unitDivider; }
+      // unit of the recorded elapsed times
+      Unit unit() const { return _unit; }
+      const char* unitName() const { return _unit == Unit::MICROSECONDS ? "us" : "ms"; }
       // number of bins
       uint8_t bins() const { return _binCount; }
       // total number of entries
-      uint32_t count() const { return _count; }
+      uint32_t count() const { return _count.load(std::memory_order_relaxed); }
       // number of entries in a bin
-      uint16_t bin(uint8_t index) const { return index < _binCount ? _bins[index] : 0; }
+      Counter bin(uint8_t index) const { return index < _binCount ? _bins[index].load(std::memory_order_relaxed) : 0; }
+      // smallest and biggest recorded value, in the recorded unit
+      uint32_t min() const { return count() ? _min.load(std::memory_order_relaxed) : 0; }
+      uint32_t max() const { return _max.load(std::memory_order_relaxed); }
+      // sum of all the recorded values in the recorded unit: the total busy time of a task
+      uint64_t sum() const {
+        Snapshot snapshot;
+        this->snapshot(snapshot);
+        return snapshot.sum;
+      }
+      uint32_t mean() const {
+        Snapshot snapshot;
+        this->snapshot(snapshot);
+        return snapshot.mean();
+      }
+      // estimate of the p-th percentile (p between 0 and 100) in the recorded unit
+      uint32_t percentile(float p) const {
+        Snapshot snapshot;
+        this->snapshot(snapshot);
+        return snapshot.percentile(p);
+      }
+
+      // Take a consistent copy of the statistics without blocking the writer.
+      // Returns false if the statistics kept changing during the copy: the snapshot might then be inconsistent.
+      bool snapshot(Snapshot& snapshot) const {
+        snapshot.binCount = _binCount;
+        snapshot.unitDivider = _unitDivider;
+        snapshot.unit = _unit;
+        for (uint8_t attempt = 0; attempt < 8; attempt++) {
+          const uint32_t seq = _seq.load(std::memory_order_acquire);
+          if (seq & 1)
+            continue;
+          snapshot.count = _count.load(std::memory_order_relaxed);
+          snapshot.clears = _clears.load(std::memory_order_relaxed);
+          snapshot.min = snapshot.count ? _min.load(std::memory_order_relaxed) : 0;
+          snapshot.max = _max.load(std::memory_order_relaxed);
+          snapshot.sum = static_cast<uint64_t>(_sumHigh.load(std::memory_order_relaxed)) << 32 | _sumLow.load(std::memory_order_relaxed);
+          for (uint8_t i = 0; i < _binCount; i++)
+            snapshot.bins[i] = _bins[i].load(std::memory_order_relaxed);
+          for (size_t i = 0; i < _binCount * SUB_BINS; i++)
+            snapshot.subBins[i] = _subBins[i].load(std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (_seq.load(std::memory_order_relaxed) == seq)
+            return true;
+        }
+        return false;
+      }
 
+      // Statistics sent by the last binary export of the task manager, to only send the differences on the next one.
+      // Allocated on the first export, or nullptr if out of memory. To be used by one exporter at a time.
+      Snapshot* exported() const {
+        if (!_exported)
+          _exported = new (std::nothrow) Snapshot();
+        return _exported;
+      }
+
+      // record() and clear() must be called by one writer at a time (the task or task manager being profiled).
+      // Readers use a sequence counter to detect a concurrent write.
       void clear() {
-        _count = 0;
+        _beginWrite();
+        _clears.store(_clears.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        _count.store(0, std::memory_order_relaxed);
+        _min.store(UINT32_MAX, std::memory_order_relaxed);
+        _max.store(0, std::memory_order_relaxed);
+        _sumLow.store(0, std::memory_order_relaxed);
+        _sumHigh.store(0, std::memory_order_relaxed);
         for (size_t i = 0; i < _binCount; i++)
-          _bins[i] = 0;
+          _bins[i].store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < _binCount * SUB_BINS; i++)
+          _subBins[i].store(0, std::memory_order_relaxed);
+        _endWrite();
       }
 
       void record(uint32_t elapsed) {
-        if (_count == UINT32_MAX)
+        uint32_t count = _count.load(std::memory_order_relaxed);
+        if (count == UINT32_MAX) {
           clear();
-        _count++;
-        if (!_binCount)
-          return;
-        uint8_t bin = 0;
-        elapsed = elapsed / _unitDivider;
-        while (elapsed >>= 1 && bin < _binCount - 1)
-          bin++;
-        if (_bins[bin] < UINT16_MAX) {
-          _bins[bin]++;
+          count = 0;
         }
+        _beginWrite();
+        _count.store(count + 1, std::memory_order_relaxed);
+        if (elapsed < _min.load(std::memory_order_relaxed))
+          _min.store(elapsed, std::memory_order_relaxed);
+        if (elapsed > _max.load(std::memory_order_relaxed))
+          _max.store(elapsed, std::memory_order_relaxed);
+        const uint32_t sumLow = _sumLow.load(std::memory_order_relaxed);
+        _sumLow.store(sumLow + elapsed, std::memory_order_relaxed);
+        if (sumLow + elapsed < sumLow)
+          _sumHigh.store(_sumHigh.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (_binCount) {
+          // the bin is the position of the highest bit: 0 and 1 go in bin 0
+          const uint32_t scaled = _unitShift >= 0 ? elapsed >> _unitShift : elapsed / _unitDivider;
+          uint8_t bin = 31 - __builtin_clz(scaled | 1);
+          if (bin >= _binCount)
+            bin = _binCount - 1;
+          const Counter value = _bins[bin].load(std::memory_order_relaxed);
+          if (value != static_cast<Counter>(-1))
+            _bins[bin].store(value + 1, std::memory_order_relaxed);
+          // linear position inside the bin, the values above the last bin going in its last sub-bin
+          const uint8_t shift = bin ? bin : 1;
+          uint64_t sub = (static_cast<uint64_t>(scaled - (bin ? 1U << bin : 0)) * SUB_BINS) >> shift;
+          if (sub >= SUB_BINS)
+            sub = SUB_BINS - 1;
+          std::atomic<Counter>& subBin = _subBins[bin * SUB_BINS + sub];
+          const Counter subValue = subBin.load(std::memory_order_relaxed);
+          if (subValue != static_cast<Counter>(-1))
+            subBin.store(subValue + 1, std::memory_order_relaxed);
+        }
+        _endWrite();
       }
 
+      // record an elapsed time in microseconds, converted to the unit of these statistics
+      void recordMicros(uint32_t elapsedMicros) { record(_unit == Unit::MICROSECONDS ? elapsedMicros : elapsedMicros / 1000); }
+
 #ifdef MYCILA_JSON_SUPPORT
       void toJson(const JsonObject& root) const {
-        root["count"] = _count;
-        root["unit_divider"] = _unitDivider;
-        for (size_t i = 0; i < _binCount; i++)
-          root["bins"][i] = _bins[i];
+        Snapshot snapshot;
+        this->snapshot(snapshot);
+        snapshot.toJson(root);
       }
 #endif
 
     private:
       uint8_t _binCount;
       uint32_t _unitDivider;
-      uint16_t* _bins;
-      uint32_t _count = 0;
+      // log2 of the divider, or -1 if it is not a power of 2
+      int8_t _unitShift;
+      Unit _unit;
+      std::atomic<Counter>* _bins;
+      std::atomic<Counter>* _subBins;
+      std::atomic<uint32_t> _count{0};
+      std::atomic<uint32_t> _clears{0};
+      std::atomic<uint32_t> _min{UINT32_MAX};
+      std::atomic<uint32_t> _max{0};
+      // 64 bits sum split in 2 words: 64 bits atomics are not lock-free on ESP32
+      std::atomic<uint32_t> _sumLow{0};
+      std::atomic<uint32_t> _sumHigh{0};
+      // odd while a write is in progress
+      std::atomic<uint32_t> _seq{0};
+      mutable Snapshot* _exported = nullptr;
+
+      void _beginWrite() {
+        _seq.store(_seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+      }
+      void _endWrite() { _seq.store(_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+  };
+
+  // Total of microseconds split in 2 words like the sum of BinStatistics: 64 bits atomics are not lock-free on ESP32.
+  // Several FreeRTOS tasks can add to it: the ones in the middle of an add are counted so that a reader does not see
+  // the low word wrapped before the carry reaches the high word.
+  class MicrosCounter {
+    public:
+      void add(uint32_t micros) {
+        _adding.fetch_add(1, std::memory_order_acquire);
+        const uint32_t low = _low.fetch_add(micros, std::memory_order_relaxed);
+        if (low + micros < low)
+          _high.fetch_add(1, std::memory_order_relaxed);
+        _adding.fetch_sub(1, std::memory_order_release);
+      }
+
+      uint64_t load() const {
+        uint32_t high = 0;
+        uint32_t low = 0;
+        for (uint8_t attempt = 0; attempt < 8; attempt++) {
+          const uint32_t adding = _adding.load(std::memory_order_acquire);
+          high = _high.load(std::memory_order_relaxed);
+          low = _low.load(std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (!adding && !_adding.load(std::memory_order_relaxed) && _high.load(std::memory_order_relaxed) == high)
+            break;
+        }
+        return static_cast<uint64_t>(high) << 32 | low;
+      }
+
+      // to be called while nothing adds to it
+      void clear() {
+        _low.store(0, std::memory_order_relaxed);
+        _high.store(0, std::memory_order_relaxed);
+      }
+
+    private:
+      std::atomic<uint32_t> _low{0};
+      std::atomic<uint32_t> _high{0};
+      std::atomic<uint32_t> _adding{0};
+  };
+
+  // A ring of statistics, one per time window (for example one per minute), to see the recent load instead of the whole history.
+  // All the windows are allocated up front: rotating to a new window only clears the oldest one.
+  class WindowedBinStatistics {
+    public:
+      // windowCount windows of windowMillis each, the other parameters are the ones of BinStatistics
+      WindowedBinStatistics(uint8_t windowCount, uint32_t windowMillis, uint8_t binCount, uint32_t unitDivider = 1, BinStatistics::Unit unit = BinStatistics::Unit::MILLISECONDS) : _windowCount(windowCount ? windowCount : 1), _windowMillis(windowMillis ? windowMillis : 1) {
+        _windows = static_cast<BinStatistics*>(::operator new(sizeof(BinStatistics) * _windowCount));
+        _epochs = new std::atomic<uint32_t>[_windowCount];
+        for (uint8_t i = 0; i < _windowCount; i++) {
+          new (&_windows[i]) BinStatistics(binCount, unitDivider, unit);
+          _epochs[i].store(NO_EPOCH, std::memory_order_relaxed);
+        }
+      }
+
+      ~WindowedBinStatistics() {
+        for (uint8_t i = 0; i < _windowCount; i++)
+          _windows[i].~BinStatistics();
+        ::operator delete(_windows);
+        delete[] _epochs;
+      }
+
+      // number of windows
+      uint8_t windows() const { return _windowCount; }
+      // duration of a window in milliseconds
+      uint32_t windowMillis() const { return _windowMillis; }
+      // unit of the recorded elapsed times
+      BinStatistics::Unit unit() const { return _windows[0].unit(); }
+
+      // record an elapsed time in the window of nowMillis, rotating the windows if needed
+      // must be called by one writer at a time, like BinStatistics::record()
+      void record(uint32_t elapsed, uint32_t nowMillis) { _window(nowMillis).record(elapsed); }
+      void recordMicros(uint32_t elapsedMicros, uint32_t nowMillis) { _window(nowMillis).recordMicros(elapsedMicros); }
+
+      // Take a consistent copy of a window: age 0 is the current window, 1 the previous one, etc.
+      // startMillis receives the start time of the window.
+      // Returns false if nothing was recorded in this window or if it was rotated during the copy.
+      bool snapshot(uint8_t age, BinStatistics::Snapshot& snapshot, uint32_t& startMillis) const {
+        if (age >= _windowCount)
+          return false;
+        const uint32_t epoch = _current.load(std::memory_order_acquire) - age;
+        const uint8_t slot = epoch % _windowCount;
+        if (_epochs[slot].load(std::memory_order_acquire) != epoch)
+          return false;
+        const bool consistent = _windows[slot].snapshot(snapshot);
+        if (!consistent || _epochs[slot].load(std::memory_order_acquire) != epoch)
+          return false;
+        startMillis = epoch * _windowMillis;
+        return snapshot.count;
+      }
+
+#ifdef MYCILA_JSON_SUPPORT
+      // json array of the windows which have entries, from the current one to the oldest one
+      void toJson(const JsonArray& root) const {
+        BinStatistics::Snapshot snapshot;
+        uint32_t start;
+        for (uint8_t age = 0; age < _windowCount; age++) {
+          if (this->snapshot(age, snapshot, start)) {
+            JsonObject window = root.add<JsonObject>();
+            window["start"] = start;
+            window["duration"] = _windowMillis;
+            snapshot.toJson(window);
+          }
+        }
+      }
+#endif
+
+    private:
+      static constexpr uint32_t NO_EPOCH = UINT32_MAX;
+
+      uint8_t _windowCount;
+      uint32_t _windowMillis;
+      BinStatistics* _windows;
+      // window number (time / window duration) held by each slot
+      std::atomic<uint32_t>* _epochs;
+      std::atomic<uint32_t> _current{0};
+
+      BinStatistics& _window(uint32_t nowMillis) {
+        const uint32_t epoch = nowMillis / _windowMillis;
+        const uint8_t slot = epoch % _windowCount;
+        if (_epochs[slot].load(std::memory_order_relaxed) != epoch) {
+          // the slot holds an old window: reuse it
+          _epochs[slot].store(NO_EPOCH, std::memory_order_relaxed);
+          _windows[slot].clear();
+          _epochs[slot].store(epoch, std::memory_order_release);
+        }
+        _current.store(epoch, std::memory_order_release);
+        return _windows[slot];
+      }
   };
 } // namespace Mycila
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2023-2025 Mathieu Carbou
+ */
+#pragma once
+
+#include "MycilaTaskManagerPlatform.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace Mycila {
+  // A Print writing to a buffer owned by the caller, to use log() and toJson() without allocating.
+  // The content is always null-terminated: what does not fit is dropped and overflow() becomes true.
+  class BufferPrint : public Print {
+    public:
+      BufferPrint(char* buffer, size_t size) : _buffer(buffer), _size(size) { clear(); }
+
+      // keep the other overloads of Print, like write(const char*), visible
+      using Print::write;
+      size_t write(uint8_t c) override { return write(&c, 1); }
+      size_t write(const uint8_t* buffer, size_t size) override {
+        if (!_size)
+          return 0;
+        const size_t room = _size - 1 - _length;
+        if (size > room) {
+          _overflow = true;
+          size = room;
+        }
+        memcpy(_buffer + _length, buffer, size);
+        _length += size;
+        _buffer[_length] = '\0';
+        return size;
+      }
+
+      const char* c_str() const { return _buffer; }
+      size_t length() const { return _length; }
+      // true if some content did not fit in the buffer
+      bool overflow() const { return _overflow; }
+
+      void clear() {
+        _length = 0;
+        _overflow = false;
+        if (_size)
+          _buffer[0] = '\0';
+      }
+
+    private:
+      char* _buffer;
+      size_t _size;
+      size_t _length = 0;
+      bool _overflow = false;
+  };
+} // namespace Mycila
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2023-2025 Mathieu Carbou
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef MYCILA_DELEGATE_SIZE
+  // bytes available to store the callable and its captures
+  #define MYCILA_DELEGATE_SIZE (2 * sizeof(void*))
+#endif
+
+namespace Mycila {
+  template <typename Signature, size_t Size = MYCILA_DELEGATE_SIZE>
+  class Delegate;
+
+  // A lightweight replacement of std::function which never allocates.
+  // It can hold a function pointer or a lambda whose captures fit in Size bytes.
+  // The callable must be trivially copyable and destructible (capture pointers and values, not objects owning memory).
+  template <typename R, typename... Args, size_t Size>
+  class Delegate<R(Args...), Size> {
+    public:
+      Delegate() = default;
+      Delegate(std::nullptr_t) {} // NOLINT
+
+      template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Delegate>::value>::type>
+      Delegate(F&& fn) { // NOLINT
+        typedef typename std::decay<F>::type Callable;
+        static_assert(sizeof(Callable) <= Size, "Callable too big: reduce the captures or increase MYCILA_DELEGATE_SIZE");
+        static_assert(alignof(Callable) <= alignof(void*), "Callable alignment not supported");
+        static_assert(std::is_trivially_copyable<Callable>::value && std::is_trivially_destructible<Callable>::value, "Callable must be trivially copyable and destructible");
+        if (_isNull(fn))
+          return;
+        new (_storage) Callable(std::forward<F>(fn));
+        _invoke = [](const void* storage, Args... args) -> R { return (*static_cast<Callable*>(const_cast<void*>(storage)))(std::forward<Args>(args)...); };
+      }
+
+      Delegate& operator=(std::nullptr_t) {
+        _invoke = nullptr;
+        return *this;
+      }
+
+      explicit operator bool() const { return _invoke; }
+
+      R operator()(Args... args) const { return _invoke(_storage, std::forward<Args>(args)...); }
+
+    private:
+      R (*_invoke)(const void* storage, Args... args) = nullptr;
+      alignas(void*) uint8_t _storage[Size];
+
+      template <typename F>
+      static bool _isNull(const F& fn) {
+        if constexpr (std::is_pointer<F>::value)
+          return !fn;
+        else
+          return false;
+      }
+  };
+} // namespace Mycila
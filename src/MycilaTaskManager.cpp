@@ -2,14 +2,17 @@
 /*
  * Copyright (C) 2023-2025 Mathieu Carbou
  */
+#include <MycilaBufferPrint.h>
 #include <MycilaTaskManager.h>
 
-#include <esp32-hal-log.h>
-#include <esp_timer.h>
+#include <algorithm>
 
-#include <string>
-
-#ifdef MYCILA_LOGGER_SUPPORT
+#if defined(MYCILA_TASK_MANAGER_NO_LOGGING)
+  #define LOGD(tag, format, ...) ((void)0)
+  #define LOGI(tag, format, ...) ((void)0)
+  #define LOGW(tag, format, ...) ((void)0)
+  #define LOGE(tag, format, ...) ((void)0)
+#elif defined(MYCILA_LOGGER_SUPPORT)
   #include <MycilaLogger.h>
 extern Mycila::Logger logger;
   #define LOGD(tag, format, ...) logger.debug(tag, format, ##__VA_ARGS__)
@@ -25,27 +28,839 @@ extern Mycila::Logger logger;
 
 #define TAG "TASKS"
 
-static bool PREDICATE_FALSE() { return false; };
+#ifndef MYCILA_TASK_MANAGER_NO_COALESCING
+// early run requests can come from any FreeRTOS task
+static portMUX_TYPE coalescingLock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+// size of a log line
+#define LOG_LINE_SIZE 384
+// size of a statistics line: the name, the counters and MAX_BINS bins of up to 21 characters (" | 4294967295 >= 2^31")
+#define STATS_LINE_SIZE (192 + 21 * Mycila::BinStatistics::MAX_BINS)
+
+// send a line to out, or to the log if out is null
+static void emitLine(Print* out, const Mycila::BufferPrint& line) {
+  if (out)
+    out->println(line.c_str());
+  else
+    LOGI(TAG, "%s", line.c_str());
+}
+
+static void printPadded(Print& out, const char* text, size_t width) {
+  for (size_t length = strlen(text); length < width; length++)
+    out.print(' ');
+  out.print(text);
+}
+
+static void printJsonString(Print& out, const char* text) {
+  out.print('"');
+  for (; *text; text++) {
+    const char c = *text;
+    if (c == '"' || c == '\\') {
+      out.print('\\');
+      out.print(c);
+    } else if (static_cast<uint8_t>(c) < 0x20) {
+      const char hex[] = "0123456789abcdef";
+      out.print("\\u00");
+      out.print(hex[c >> 4]);
+      out.print(hex[c & 0xf]);
+    } else {
+      out.print(c);
+    }
+  }
+  out.print('"');
+}
+
+// print the statistics line of a task or task manager
+static void printStatistics(Print* out, const char* name, const Mycila::BinStatistics* stats, const char* kind = "") {
+  if (!stats)
+    return;
+
+  Mycila::BinStatistics::Snapshot snapshot;
+  stats->snapshot(snapshot);
+  const uint8_t binCount = snapshot.binCount;
+
+  if (!binCount || !snapshot.count)
+    return;
+
+  char buffer[STATS_LINE_SIZE];
+  Mycila::BufferPrint line(buffer, sizeof(buffer));
+  line.print("| ");
+  printPadded(line, name, 30);
+  line.print(kind);
+  for (uint8_t i = 0; i < binCount; i++) {
+    line.print(" | ");
+    line.print(snapshot.bins[i]);
+    line.print(i < binCount - 1 ? " < 2^" : " >= 2^");
+    line.print(static_cast<unsigned>(i < binCount - 1 ? (i + 1) : i));
+  }
+  line.print(" | count=");
+  line.print(snapshot.count);
+  line.print(" min=");
+  line.print(snapshot.min);
+  line.print(" mean=");
+  line.print(snapshot.mean());
+  line.print(" p95=");
+  line.print(snapshot.percentile(95));
+  line.print(" max=");
+  line.print(snapshot.max);
+  line.print(" unit=");
+  line.print(stats->unitName());
+  emitLine(out, line);
+}
+
+static void printTask(Print* out, const Mycila::Task& task) {
+  printStatistics(out, task.name(), task.statistics());
+  printStatistics(out, task.name(), task.latencyStatistics(), " latency");
+  if (task.scheduling() != Mycila::Task::Scheduling::FIXED_DELAY || task.coalescing() || task.overruns() || task.timeouts()) {
+    char buffer[LOG_LINE_SIZE];
+    Mycila::BufferPrint line(buffer, sizeof(buffer));
+    line.print("| ");
+    printPadded(line, task.name(), 30);
+    line.print(" missed=");
+    line.print(task.missedDeadlines());
+    line.print(" overruns=");
+    line.print(task.overruns());
+    line.print(" coalesced=");
+    line.print(task.coalesced());
+    line.print(" timeouts=");
+    line.print(task.timeouts());
+    emitLine(out, line);
+  }
+  if (task.busyMicros() || task.predicateMicros()) {
+    char buffer[LOG_LINE_SIZE];
+    Mycila::BufferPrint line(buffer, sizeof(buffer));
+    line.print("| ");
+    printPadded(line, task.name(), 30);
+    line.print(" busy=");
+    line.print(task.busyMicros());
+    line.print(" predicates=");
+    line.print(task.predicateMicros());
+    line.print(" unit=us cpu=");
+    line.print(task.utilization());
+    line.print('%');
+    emitLine(out, line);
+  }
+}
+
+// print the fields of the statistics, without the braces
+static void printSnapshotJson(Print& out, const Mycila::BinStatistics::Snapshot& snapshot) {
+  out.print("\"count\":");
+  out.print(snapshot.count);
+  out.print(",\"unit_divider\":");
+  out.print(snapshot.unitDivider);
+  out.print(",\"unit\":");
+  out.print(snapshot.unit == Mycila::BinStatistics::Unit::MICROSECONDS ? "\"us\"" : "\"ms\"");
+  out.print(",\"min\":");
+  out.print(snapshot.min);
+  out.print(",\"max\":");
+  out.print(snapshot.max);
+  out.print(",\"mean\":");
+  out.print(snapshot.mean());
+  out.print(",\"total\":");
+  out.print(static_cast<unsigned long long>(snapshot.sum));
+  out.print(",\"p50\":");
+  out.print(snapshot.percentile(50));
+  out.print(",\"p95\":");
+  out.print(snapshot.percentile(95));
+  out.print(",\"p99\":");
+  out.print(snapshot.percentile(99));
+  out.print(",\"bins\":[");
+  for (size_t i = 0; i < snapshot.binCount; i++) {
+    if (i)
+      out.print(',');
+    out.print(snapshot.bins[i]);
+  }
+  out.print(']');
+}
+
+// print ,"key":{...} if there are statistics
+static void printStatisticsJson(Print& out, const char* key, const Mycila::BinStatistics* stats) {
+  if (!stats || !stats->bins() || !stats->count())
+    return;
+  Mycila::BinStatistics::Snapshot snapshot;
+  stats->snapshot(snapshot);
+  out.print(",\"");
+  out.print(key);
+  out.print("\":{");
+  printSnapshotJson(out, snapshot);
+  out.print('}');
+}
+
+// print ,"windows":[...] if there are windowed statistics
+static void printWindowsJson(Print& out, const Mycila::WindowedBinStatistics* stats) {
+  if (!stats)
+    return;
+  out.print(",\"windows\":[");
+  Mycila::BinStatistics::Snapshot snapshot;
+  uint32_t start;
+  bool first = true;
+  for (uint8_t age = 0; age < stats->windows(); age++) {
+    if (!stats->snapshot(age, snapshot, start))
+      continue;
+    if (!first)
+      out.print(',');
+    first = false;
+    out.print("{\"start\":");
+    out.print(start);
+    out.print(",\"duration\":");
+    out.print(stats->windowMillis());
+    out.print(',');
+    printSnapshotJson(out, snapshot);
+    out.print('}');
+  }
+  out.print(']');
+}
+
+#ifndef MYCILA_TASK_MANAGER_NO_BINARY
+  #define BINARY_VERSION 2
+
+static void writeVarint(Print& out, uint64_t value) {
+  uint8_t buffer[10];
+  size_t length = 0;
+  do {
+    const uint8_t byte = value & 0x7f;
+    value >>= 7;
+    buffer[length++] = value ? byte | 0x80 : byte;
+  } while (value);
+  out.write(buffer, length);
+}
+
+static void writeName(Print& out, const char* name) {
+  const size_t length = strlen(name);
+  writeVarint(out, length);
+  out.write(reinterpret_cast<const uint8_t*>(name), length);
+}
+
+// write the statistics, or their differences since the previous export if possible
+static void writeStatistics(Print& out, const Mycila::BinStatistics* stats, bool delta) {
+  if (!stats) {
+    out.write(static_cast<uint8_t>(0));
+    return;
+  }
+  Mycila::BinStatistics::Snapshot snapshot;
+  stats->snapshot(snapshot);
+  Mycila::BinStatistics::Snapshot* exported = stats->exported();
+  // the statistics were cleared or replaced since the previous export: send them in full
+  if (!exported || exported->clears != snapshot.clears || exported->count > snapshot.count)
+    delta = false;
+  out.write(static_cast<uint8_t>(1 | (delta ? 2 : 0) | (snapshot.unit == Mycila::BinStatistics::Unit::MICROSECONDS ? 4 : 0)));
+  writeVarint(out, snapshot.unitDivider);
+  writeVarint(out, snapshot.binCount);
+  writeVarint(out, snapshot.count - (delta ? exported->count : 0));
+  writeVarint(out, snapshot.min);
+  writeVarint(out, snapshot.max);
+  writeVarint(out, snapshot.sum - (delta ? exported->sum : 0));
+  for (uint8_t i = 0; i < snapshot.binCount; i++)
+    writeVarint(out, static_cast<Mycila::BinStatistics::Counter>(snapshot.bins[i] - (delta ? exported->bins[i] : 0)));
+  if (exported)
+    *exported = snapshot;
+}
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+// publish the statistics, re-using the retired ones if they have the same configuration
+static void enableStatistics(std::atomic<Mycila::BinStatistics*>& stats, Mycila::BinStatistics*& retired, uint8_t binCount, uint32_t unitDivider, Mycila::BinStatistics::Unit unit) {
+  if (stats.load(std::memory_order_relaxed))
+    return;
+  Mycila::BinStatistics* enabled = retired;
+  retired = nullptr;
+  if (enabled && enabled->bins() == std::min(binCount, Mycila::BinStatistics::MAX_BINS) && enabled->unitDivider() == unitDivider && enabled->unit() == unit) {
+    enabled->clear();
+  } else {
+    delete enabled;
+    enabled = new Mycila::BinStatistics(binCount, unitDivider, unit);
+  }
+  stats.store(enabled, std::memory_order_release);
+}
+
+// detach the statistics but keep them alive for the readers which might still use them
+static void disableStatistics(std::atomic<Mycila::BinStatistics*>& stats, Mycila::BinStatistics*& retired) {
+  Mycila::BinStatistics* disabled = stats.exchange(nullptr, std::memory_order_acq_rel);
+  if (disabled) {
+    delete retired;
+    retired = disabled;
+  }
+}
+
+static void enableWindowedStatistics(std::atomic<Mycila::WindowedBinStatistics*>& stats, Mycila::WindowedBinStatistics*& retired, uint8_t windowCount, uint32_t windowMillis, uint8_t binCount, uint32_t unitDivider, Mycila::BinStatistics::Unit unit) {
+  if (stats.load(std::memory_order_relaxed))
+    return;
+  delete retired;
+  retired = nullptr;
+  stats.store(new Mycila::WindowedBinStatistics(windowCount, windowMillis, binCount, unitDivider, unit), std::memory_order_release);
+}
+
+static void disableWindowedStatistics(std::atomic<Mycila::WindowedBinStatistics*>& stats, Mycila::WindowedBinStatistics*& retired) {
+  Mycila::WindowedBinStatistics* disabled = stats.exchange(nullptr, std::memory_order_acq_rel);
+  if (disabled) {
+    delete retired;
+    retired = disabled;
+  }
+}
+
+void Mycila::TaskManager::enableOverheadProfiling() {
+  _overheadProfiling = false;
+  _loopUs.clear();
+  _taskUs.clear();
+  _passes = 0;
+  _wastedPasses = 0;
+  for (Task* task : _tasks) {
+    task->_busyUs.clear();
+    task->_predicateUs.clear();
+    task->_overheadProfiling = true;
+  }
+  _overheadEnd = 0;
+  _overheadStart = esp_timer_get_time();
+  _overheadProfiling = true;
+}
+
+void Mycila::TaskManager::disableOverheadProfiling() {
+  if (!_overheadProfiling)
+    return;
+  _overheadProfiling = false;
+  _overheadEnd = esp_timer_get_time();
+  for (Task* task : _tasks)
+    task->_overheadProfiling = false;
+}
+
+Mycila::TaskManager::Overhead Mycila::TaskManager::overhead() const {
+  Overhead overhead;
+  if (!_overheadStart)
+    return overhead;
+  overhead.elapsed = (_overheadEnd ? _overheadEnd : esp_timer_get_time()) - _overheadStart;
+  for (Task* task : _tasks)
+    overhead.predicates += task->predicateMicros();
+  overhead.tasks = _taskUs.load();
+  overhead.passes = _passes.load(std::memory_order_relaxed);
+  overhead.wastedPasses = _wastedPasses.load(std::memory_order_relaxed);
+  // the counters are read one after the other while loop() is running: do not go below 0
+  const int64_t loop = _loopUs.load();
+  overhead.poll = std::max<int64_t>(0, loop - overhead.tasks - overhead.predicates);
+  overhead.idle = std::max<int64_t>(0, overhead.elapsed - loop);
+  return overhead;
+}
+
+// print the overhead line of a task manager
+static void printOverhead(Print* out, const char* name, const Mycila::TaskManager::Overhead& overhead) {
+  char buffer[LOG_LINE_SIZE];
+  Mycila::BufferPrint line(buffer, sizeof(buffer));
+  line.print("| ");
+  printPadded(line, name, 30);
+  line.print(" elapsed=");
+  line.print(overhead.elapsed);
+  line.print(" poll=");
+  line.print(overhead.poll);
+  line.print(" predicates=");
+  line.print(overhead.predicates);
+  line.print(" tasks=");
+  line.print(overhead.tasks);
+  line.print(" idle=");
+  line.print(overhead.idle);
+  line.print(" passes=");
+  line.print(overhead.passes);
+  line.print(" wasted=");
+  line.print(overhead.wastedPasses);
+  line.print(" unit=us");
+  emitLine(out, line);
+}
+#endif
 
 void Mycila::TaskManager::log() {
-  if (_stats) {
-    const uint8_t binCount = _stats->bins();
-    const uint32_t count = _stats->count();
-    if (binCount && count) {
-      std::string line;
-      line.reserve(192);
-      for (uint8_t i = 0; i < binCount; i++) {
-        line += " | ";
-        line += std::to_string(_stats->bin(i));
-        line += (i < binCount - 1 ? " < 2^" : " >= 2^");
-        line += std::to_string(i < binCount - 1 ? (i + 1) : i);
+  printStatistics(nullptr, _name, statistics());
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+  if (_overheadStart)
+    printOverhead(nullptr, _name, overhead());
+#endif
+  for (Task* task : _tasks)
+    printTask(nullptr, *task);
+}
+
+void Mycila::TaskManager::log(Print& out) {
+  printStatistics(&out, _name, statistics());
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+  if (_overheadStart)
+    printOverhead(&out, _name, overhead());
+#endif
+  for (Task* task : _tasks)
+    printTask(&out, *task);
+}
+
+void Mycila::TaskManager::toJson(Print& out) const {
+  out.print("{\"name\":");
+  printJsonString(out, _name);
+  printStatisticsJson(out, "stats", statistics());
+  printWindowsJson(out, windowedStatistics());
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+  if (_overheadStart) {
+    const Overhead o = overhead();
+    out.print(",\"overhead\":{\"elapsed\":");
+    out.print(o.elapsed);
+    out.print(",\"poll\":");
+    out.print(o.poll);
+    out.print(",\"predicates\":");
+    out.print(o.predicates);
+    out.print(",\"tasks\":");
+    out.print(o.tasks);
+    out.print(",\"idle\":");
+    out.print(o.idle);
+    out.print(",\"passes\":");
+    out.print(o.passes);
+    out.print(",\"wasted\":");
+    out.print(o.wastedPasses);
+    out.print('}');
+  }
+#endif
+  out.print(",\"tasks\":[");
+  bool first = true;
+  for (Task* task : _tasks) {
+    if (!first)
+      out.print(',');
+    first = false;
+    task->toJson(out);
+  }
+  out.print("]}");
+}
+
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+void Mycila::TaskManager::enableProfiling(uint8_t taskManagerBinCount, uint32_t unitDivider, BinStatistics::Unit unit) {
+  enableStatistics(_stats, _retiredStats, taskManagerBinCount, unitDivider, unit);
+}
+
+void Mycila::TaskManager::disableProfiling() {
+  disableStatistics(_stats, _retiredStats);
+  for (Task* task : _tasks)
+    task->disableProfiling();
+}
+
+void Mycila::TaskManager::enableWindowedProfiling(uint8_t windowCount, uint32_t windowMillis, uint8_t taskManagerBinCount, uint8_t taskBinCount, uint32_t unitDivider, BinStatistics::Unit unit) {
+  enableWindowedStatistics(_windowedStats, _retiredWindowedStats, windowCount, windowMillis, taskManagerBinCount, unitDivider, unit);
+  for (Task* task : _tasks)
+    task->enableWindowedProfiling(windowCount, windowMillis, taskBinCount, unitDivider, unit);
+}
+
+void Mycila::TaskManager::disableWindowedProfiling() {
+  disableWindowedStatistics(_windowedStats, _retiredWindowedStats);
+  for (Task* task : _tasks)
+    task->disableWindowedProfiling();
+}
+#endif
+
+Mycila::TaskManager::~TaskManager() {
+#ifndef MYCILA_TASK_MANAGER_NO_TIMEOUTS
+  disableTimeoutMonitor();
+#endif
+  _removeAll();
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+  _scheduleFree(_schedule.load());
+  _scheduleFree(_retiredSchedule);
+#endif
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+  delete _stats.load();
+  delete _retiredStats;
+  delete _windowedStats.load();
+  delete _retiredWindowedStats;
+#endif
+}
+
+void Mycila::TaskManager::setScheduler(Scheduler scheduler) {
+  if (_scheduler == scheduler)
+    return;
+  portENTER_CRITICAL(&_heapLock);
+  for (Task* task : _heap)
+    task->_heapIndex = -1;
+  _heap.clear();
+  _scheduler = scheduler;
+  portEXIT_CRITICAL(&_heapLock);
+  if (_scheduler == Scheduler::DEADLINE) {
+    _reserve(_tasks.size());
+    for (Task* task : _tasks)
+      _reschedule(*task);
+  }
+}
+
+void Mycila::TaskManager::_popDue(int64_t now) {
+  _due.clear();
+  // grown here, outside of the pass which iterates it and outside of the lock
+  if (_due.capacity() < _heap.capacity())
+    _due.reserve(_heap.capacity());
+  portENTER_CRITICAL(&_heapLock);
+  while (!_heap.empty() && _heap[0]->_due(now)) {
+    Task* task = _heap[0];
+    _unschedule(*task);
+    // insertion sort: the tasks with the same priority stay in due order
+    _due.push_back(task);
+    size_t i = _due.size() - 1;
+    for (; i && _due[i - 1]->_priority < task->_priority; i--)
+      _due[i] = _due[i - 1];
+    _due[i] = task;
+  }
+  portEXIT_CRITICAL(&_heapLock);
+}
+
+size_t Mycila::TaskManager::_loopDeadline(int64_t now) {
+  // pop all the due tasks first: running them will re-insert them in the heap at their next due time
+  _popDue(now);
+
+  size_t executed = 0;
+  bool deferred = false;
+  // by index: a task can add or remove tasks, and _detach() clears the entry of a removed task
+  for (size_t i = 0; i < _due.size(); i++) {
+    Task* task = _due[i];
+    if (!task || task->_manager != this)
+      continue;
+    if (!deferred && task->tryRun()) {
+      executed++;
+      yield();
+      deferred = _overBudget(now);
+    } else {
+      // the task was due but not enabled, or is deferred: keep it at the top of the heap for the next pass
+      _reschedule(*task);
+    }
+  }
+  return executed;
+}
+
+// a before b if a is due before b
+static inline bool dueBefore(int64_t aLastEnd, int64_t aInterval, int64_t bLastEnd, int64_t bInterval) {
+  const bool aNow = aLastEnd == 0;
+  const bool bNow = bLastEnd == 0;
+  if (aNow || bNow)
+    return aNow && !bNow;
+  return aLastEnd + aInterval < bLastEnd + bInterval;
+}
+
+void Mycila::TaskManager::_reschedule(Task& task) {
+  // a running task is put back in the heap at the end of its run, and a disabled task once enabled
+#ifndef MYCILA_TASK_MANAGER_NO_PREDICATES
+  const bool disabled = !task._enabled && !task._enabledState;
+#else
+  const bool disabled = !task._enabledState;
+#endif
+  if (task._paused || task._running || disabled) {
+    _unschedule(task);
+    return;
+  }
+  portENTER_CRITICAL(&_heapLock);
+  if (task._heapIndex < 0) {
+    _heap.push_back(&task);
+    task._heapIndex = _heap.size() - 1;
+  }
+  _heapSiftUp(task._heapIndex);
+  _heapSiftDown(task._heapIndex);
+  portEXIT_CRITICAL(&_heapLock);
+}
+
+void Mycila::TaskManager::_unschedule(Task& task) {
+  portENTER_CRITICAL(&_heapLock);
+  if (task._heapIndex >= 0) {
+    const size_t index = task._heapIndex;
+    Task* last = _heap.back();
+    _heap.pop_back();
+    task._heapIndex = -1;
+    if (last != &task) {
+      _heapSet(index, last);
+      _heapSiftUp(index);
+      _heapSiftDown(last->_heapIndex);
+    }
+  }
+  portEXIT_CRITICAL(&_heapLock);
+}
+
+void Mycila::TaskManager::_heapSiftUp(size_t index) {
+  Task* task = _heap[index];
+  while (index) {
+    const size_t parent = (index - 1) / 2;
+    if (!dueBefore(task->_lastEnd, task->_intervalUs, _heap[parent]->_lastEnd, _heap[parent]->_intervalUs))
+      break;
+    _heapSet(index, _heap[parent]);
+    index = parent;
+  }
+  _heapSet(index, task);
+}
+
+void Mycila::TaskManager::_heapSiftDown(size_t index) {
+  Task* task = _heap[index];
+  const size_t size = _heap.size();
+  while (true) {
+    size_t child = 2 * index + 1;
+    if (child >= size)
+      break;
+    if (child + 1 < size && dueBefore(_heap[child + 1]->_lastEnd, _heap[child + 1]->_intervalUs, _heap[child]->_lastEnd, _heap[child]->_intervalUs))
+      child++;
+    if (!dueBefore(_heap[child]->_lastEnd, _heap[child]->_intervalUs, task->_lastEnd, task->_intervalUs))
+      break;
+    _heapSet(index, _heap[child]);
+    index = child;
+  }
+  _heapSet(index, task);
+}
+
+size_t Mycila::TaskManager::_loopTriggered() {
+  size_t executed = 0;
+  // the tasks released by the triggered ones run straight away: a chain of dependencies is not longer than the number of tasks
+  for (size_t round = 0; round < _tasks.size() && _triggeredTasks.load(std::memory_order_relaxed); round++) {
+    // take the whole stack at once and reverse it to run the tasks in the order they were triggered
+    Task* task = _triggeredTasks.exchange(nullptr, std::memory_order_acquire);
+    while (task) {
+      Task* next = task->_nextTriggered;
+      task->_nextTriggered = _triggeredRun;
+      _triggeredRun = task;
+      task = next;
+    }
+
+    // a task run here can remove the triggered tasks which did not run yet
+    while (_triggeredRun) {
+      task = _triggeredRun;
+      _triggeredRun = task->_nextTriggered;
+      task->_nextTriggered = nullptr;
+      // the task can be triggered again while it runs
+      task->_triggered = false;
+      if (task->_manager != this)
+        continue;
+      task->resume();
+      task->_requestEarlyRun();
+      if (task->tryRun()) {
+        executed++;
+        yield();
       }
-      line += " |";
-      LOGI(TAG, "| %30s%s count=%" PRIu32, _name, line.c_str(), count);
     }
   }
-  for (auto& task : _tasks)
-    task->log();
+  return executed;
+}
+
+void Mycila::TaskManager::_untrigger(Task& task) {
+  // in a pool, the triggered tasks are taken by the dispatching worker
+  const bool dispatch = _workerCount && _dispatcher != xTaskGetCurrentTaskHandle();
+  if (dispatch)
+    while (_dispatching.exchange(true, std::memory_order_acquire))
+      yield();
+
+  for (Task** link = &_triggeredRun; *link; link = &(*link)->_nextTriggered) {
+    if (*link == &task) {
+      *link = task._nextTriggered;
+      break;
+    }
+  }
+
+  // take the whole stack and push back the other tasks, the ones triggered meanwhile being kept
+  Task* head = _triggeredTasks.exchange(nullptr, std::memory_order_acquire);
+  Task* last = nullptr;
+  for (Task** link = &head; *link;) {
+    if (*link == &task) {
+      *link = task._nextTriggered;
+    } else {
+      last = *link;
+      link = &last->_nextTriggered;
+    }
+  }
+  if (last) {
+    Task* top = _triggeredTasks.load(std::memory_order_relaxed);
+    do {
+      last->_nextTriggered = top;
+    } while (!_triggeredTasks.compare_exchange_weak(top, head, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  task._nextTriggered = nullptr;
+  task._triggered = false;
+  if (dispatch)
+    _dispatching.store(false, std::memory_order_release);
+}
+
+#ifndef MYCILA_TASK_MANAGER_NO_OFFLOADING
+void Mycila::TaskManager::_loopCompleted() {
+  Task* task = _completedTasks.exchange(nullptr, std::memory_order_acquire);
+  while (task) {
+    Task* next = task->_nextCompleted;
+    task->_nextCompleted = nullptr;
+    task->_done(task->_offloadStart, task->_offloadEnd);
+    task = next;
+  }
+}
+
+void Mycila::TaskManager::_waitCompleted(Task& task) {
+  while (task._running && task._offloadHandle.load(std::memory_order_relaxed)) {
+    // from another FreeRTOS task, onDone() and the successors are left to the async loop
+    if (_remote())
+      _notify();
+    else
+      _loopCompleted();
+    if (task._running)
+      vTaskDelay(1);
+  }
+}
+#endif
+
+int64_t Mycila::TaskManager::remainingMicros() const {
+  if (_scheduler == Scheduler::DEADLINE) {
+    // the heap only holds the tasks which are not paused: its top is the next one if it is enabled
+    int64_t remaining = INT64_MAX;
+    bool found = false;
+    portENTER_CRITICAL(&_heapLock);
+    if (!_heap.empty()) {
+      found = true;
+      remaining = _heap[0]->remainingMicros();
+    }
+    portEXIT_CRITICAL(&_heapLock);
+    if (!found)
+      return INT64_MAX;
+    if (remaining) {
+      // the top task is not due yet, so no other task is due before
+      return remaining;
+    }
+  }
+  int64_t remaining = INT64_MAX;
+  for (Task* task : _tasks) {
+    if (task->scheduled() && !task->_running) {
+      remaining = std::min(remaining, task->remainingMicros());
+      if (!remaining)
+        break;
+    }
+  }
+  return remaining;
+}
+
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+void Mycila::TaskManager::enableScheduleSnapshot() {
+  for (Task* task : _tasks)
+    task->_scheduleChanged.store(true, std::memory_order_relaxed);
+  _scheduleEnabled = true;
+  _scheduleDirty = true;
+}
+
+bool Mycila::TaskManager::_growSchedule(size_t capacity) {
+  // only one array is retired at a time
+  if (_retiredSchedule) {
+    if (_scheduleReaders.load())
+      return false;
+    _scheduleFree(_retiredSchedule);
+    _retiredSchedule = nullptr;
+  }
+  ScheduleEntry* entries = _schedule.load(std::memory_order_relaxed);
+  ScheduleEntry* bigger = new (std::nothrow) ScheduleEntry[capacity];
+  if (!bigger)
+    return false;
+  std::copy(entries, entries + _scheduleSize.load(std::memory_order_relaxed), bigger);
+  _schedule.store(bigger);
+  _scheduleCapacity = capacity;
+  // the queries which started before use the old entries until they are done
+  if (_scheduleReaders.load())
+    _retiredSchedule = entries;
+  else
+    _scheduleFree(entries);
+  return true;
+}
+
+void Mycila::TaskManager::_schedulePlace(Task& task, int64_t now) {
+  ScheduleEntry* entries = _schedule.load(std::memory_order_relaxed);
+  size_t size = _scheduleSize.load(std::memory_order_relaxed);
+  if (task._scheduleIndex >= 0) {
+    for (size_t i = task._scheduleIndex; i + 1 < size; i++) {
+      entries[i] = entries[i + 1];
+      entries[i].task->_scheduleIndex = i;
+    }
+    task._scheduleIndex = -1;
+    size--;
+  }
+  // the cached result of the predicate is used: it is not evaluated again
+  if (task._manager == this && !task._running && !task._paused && task._enabledState) {
+    const ScheduleEntry entry = {task._lastEnd ? task._lastEnd + task._intervalUs : now, &task};
+    // the tasks due at the same time are kept ordered by priority
+    size_t i = size;
+    for (; i && (entries[i - 1].dueAt > entry.dueAt || (entries[i - 1].dueAt == entry.dueAt && entries[i - 1].task->_priority < task._priority)); i--) {
+      entries[i] = entries[i - 1];
+      entries[i].task->_scheduleIndex = i;
+    }
+    entries[i] = entry;
+    task._scheduleIndex = i;
+    size++;
+  }
+  _scheduleSize.store(size, std::memory_order_relaxed);
+}
+
+void Mycila::TaskManager::_scheduleErase(Task& task) {
+  _scheduleSeq.store(_scheduleSeq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  _schedulePlace(task, 0);
+  _scheduleSeq.store(_scheduleSeq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Mycila::TaskManager::_refreshSchedule() {
+  _scheduleDirty.store(false, std::memory_order_relaxed);
+  if (_retiredSchedule && !_scheduleReaders.load()) {
+    _scheduleFree(_retiredSchedule);
+    _retiredSchedule = nullptr;
+  }
+  if (_scheduleCapacity < _tasks.size() && !_growSchedule(_tasks.size() * 2)) {
+    // try again on the next pass
+    _scheduleDirty.store(true, std::memory_order_relaxed);
+    return;
+  }
+  const int64_t now = esp_timer_get_time();
+  _scheduleSeq.store(_scheduleSeq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (Task* task : _tasks)
+    if (task->_scheduleChanged.exchange(false, std::memory_order_relaxed))
+      _schedulePlace(*task, now);
+  _scheduleSeq.store(_scheduleSeq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+Mycila::Task* Mycila::TaskManager::nextDue(int64_t* dueAt) const {
+  // the readers keep the entries they load alive
+  _scheduleReaders.fetch_add(1);
+  Task* task = nullptr;
+  for (uint8_t attempt = 0; attempt < 8; attempt++) {
+    const uint32_t seq = _scheduleSeq.load(std::memory_order_acquire);
+    if (seq & 1)
+      continue;
+    const ScheduleEntry* entries = _schedule.load();
+    const bool found = entries && _scheduleSize.load(std::memory_order_relaxed);
+    const ScheduleEntry first = found ? entries[0] : ScheduleEntry{INT64_MAX, nullptr};
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (_scheduleSeq.load(std::memory_order_relaxed) != seq)
+      continue;
+    if (dueAt)
+      *dueAt = first.dueAt;
+    task = first.task;
+    break;
+  }
+  _scheduleReaders.fetch_sub(1, std::memory_order_release);
+  return task;
+}
+
+size_t Mycila::TaskManager::dueWithin(uint32_t windowMillis, Task** tasks, size_t max) const {
+  const int64_t until = esp_timer_get_time() + static_cast<int64_t>(windowMillis) * 1000;
+  _scheduleReaders.fetch_add(1);
+  size_t due = 0;
+  for (uint8_t attempt = 0; attempt < 8; attempt++) {
+    const uint32_t seq = _scheduleSeq.load(std::memory_order_acquire);
+    if (seq & 1)
+      continue;
+    const ScheduleEntry* entries = _schedule.load();
+    const size_t size = entries ? _scheduleSize.load(std::memory_order_relaxed) : 0;
+    const size_t count = std::upper_bound(entries, entries + size, until, [](int64_t time, const ScheduleEntry& entry) { return time < entry.dueAt; }) - entries;
+    for (size_t i = 0; i < count && i < max; i++)
+      tasks[i] = entries[i].task;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (_scheduleSeq.load(std::memory_order_relaxed) == seq) {
+      due = count;
+      break;
+    }
+  }
+  _scheduleReaders.fetch_sub(1, std::memory_order_release);
+  return due;
+}
+#endif
+
+void Mycila::TaskManager::_sleep() {
+  // round up to the next millisecond and the next tick to not wake up before the task is due
+  const int64_t remaining = remainingMicros();
+  const uint32_t ms = remaining >= static_cast<int64_t>(_maxSleep) * 1000 ? _maxSleep : (remaining + 999) / 1000;
+  if (!ms) {
+    yield();
+    return;
+  }
+  ulTaskNotifyTake(pdTRUE, (ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
 }
 
 bool Mycila::TaskManager::asyncStart(uint32_t stackSize, BaseType_t priority, BaseType_t coreID, uint32_t delay, bool wdt) {
@@ -71,14 +886,433 @@ bool Mycila::TaskManager::asyncStart(uint32_t stackSize, BaseType_t priority, Ba
   return b;
 }
 
-void Mycila::TaskManager::asyncStop() {
+bool Mycila::TaskManager::asyncStartPool(uint8_t workers, uint32_t stackSize, BaseType_t priority, bool pinToCores, uint32_t delay, bool wdt) {
+  if (_taskManagerHandle || !workers)
+    return false;
+
+  _delay = delay;
+  _workers = new Worker[workers];
+  _workerCount = workers;
+  const uint16_t capacity = std::max<size_t>(std::min<size_t>(_tasks.size(), UINT16_MAX), 16);
+  for (uint8_t i = 0; i < workers; i++) {
+    _workers[i].manager = this;
+    _workers[i].index = i;
+    _workers[i].queue = new Task*[capacity];
+    _workers[i].capacity = capacity;
+  }
+
+  // the workers wait for the others to be created before looping, so that a failure can delete them
+  UBaseType_t prio = priority < 0 ? uxTaskPriorityGet(NULL) : priority;
+  for (uint8_t i = 0; i < workers; i++) {
+    Worker& worker = _workers[i];
+    BaseType_t coreID = pinToCores ? i % portNUM_PROCESSORS : tskNO_AFFINITY;
+    if (xTaskCreateUniversal(_asyncWorker, _name, stackSize, &worker, prio, &worker.handle, coreID) != pdPASS) {
+      LOGE(TAG, "Task manager '%s' failed to start worker %" PRIu8, _name, i);
+      for (uint8_t j = 0; j < i; j++) {
+        if (wdt)
+          esp_task_wdt_delete(_workers[j].handle);
+        vTaskDelete(_workers[j].handle);
+      }
+      delete[] _workers;
+      _workers = nullptr;
+      _workerCount = 0;
+      return false;
+    }
+    LOGD(TAG, "Task manager '%s' started worker %" PRIu8 ": core: %d, priority: %" PRIu32 ", stack: %" PRIu32 ", handle: %p", _name, i, coreID, prio, stackSize, worker.handle);
+    if (wdt && esp_task_wdt_add(worker.handle) == ESP_OK) {
+      LOGD(TAG, "Task manager '%s' worker %" PRIu8 " added to WDT", _name, i);
+    }
+  }
+
+  _wdt = wdt;
+  // the first worker is the one woken up by the triggered tasks
+  _taskManagerHandle = _workers[0].handle;
+  _notifyAll();
+  return true;
+}
+
+void Mycila::TaskManager::asyncStop(uint32_t drainMillis) {
   if (!_taskManagerHandle)
     return;
-  LOGD(TAG, "Stopping async task manager with handle: %p", _taskManagerHandle);
-  vTaskDelete(_taskManagerHandle);
+  if (!_remote()) {
+    // the async task cannot wait for itself: it stops at the end of this pass
+    // (the workers parked by a suspend are woken up to stop too)
+    if (_asyncRequestSet(AsyncRequest::NONE, AsyncRequest::STOP, drainMillis) || _asyncRequestSet(AsyncRequest::SUSPEND, AsyncRequest::STOP, drainMillis))
+      _notifyAll();
+    return;
+  }
+  // wait for the async tasks to park, even when the suspend was asked by the task manager itself
+  while (true) {
+    const AsyncRequest request = _asyncRequest.load(std::memory_order_acquire);
+    if (request == AsyncRequest::STOP) {
+      // stopping by itself
+      while (_taskManagerHandle)
+        vTaskDelay(1);
+      return;
+    }
+    if (request == AsyncRequest::NONE)
+      asyncSuspend(drainMillis);
+    else if (_parked.load(std::memory_order_acquire) >= _asyncTasks())
+      break;
+    else
+      vTaskDelay(1);
+  }
+  // the async tasks are parked: none of them is in the middle of a task
+  if (_workers) {
+    for (uint8_t i = 0; i < _workerCount; i++) {
+      if (_workers[i].handle) {
+        LOGD(TAG, "Stopping worker %" PRIu8 " of task manager '%s' with handle: %p", i, _name, _workers[i].handle);
+        vTaskDelete(_workers[i].handle);
+      }
+    }
+  } else {
+    LOGD(TAG, "Stopping async task manager with handle: %p", _taskManagerHandle);
+    vTaskDelete(_taskManagerHandle);
+  }
+  _asyncClear();
+}
+
+bool Mycila::TaskManager::asyncSuspend(uint32_t drainMillis) {
+  if (!_taskManagerHandle || !_asyncRequestSet(AsyncRequest::NONE, AsyncRequest::SUSPEND, drainMillis))
+    return false;
+  LOGD(TAG, "Suspending async task manager '%s'", _name);
+  _notifyAll();
+  if (_remote())
+    while (_parked.load(std::memory_order_acquire) < _asyncTasks())
+      vTaskDelay(1);
+  return true;
+}
+
+bool Mycila::TaskManager::asyncResume() {
+  AsyncRequest expected = AsyncRequest::SUSPEND;
+  if (!_asyncRequest.compare_exchange_strong(expected, AsyncRequest::NONE, std::memory_order_acq_rel))
+    return false;
+  LOGD(TAG, "Resuming async task manager '%s'", _name);
+  _notifyAll();
+  return true;
+}
+
+bool Mycila::TaskManager::_asyncRequestSet(AsyncRequest expected, AsyncRequest request, uint32_t drainMillis) {
+  portENTER_CRITICAL(&_asyncLock);
+  const bool set = _asyncRequest.load(std::memory_order_relaxed) == expected;
+  if (set) {
+    _drainUntil = esp_timer_get_time() + static_cast<int64_t>(drainMillis) * 1000;
+    _asyncRequest.store(request, std::memory_order_release);
+  }
+  portEXIT_CRITICAL(&_asyncLock);
+  return set;
+}
+
+bool Mycila::TaskManager::_drained() const {
+  if (_triggeredTasks.load(std::memory_order_relaxed) || _hasCompleted())
+    return false;
+  for (Task* task : _tasks)
+    if (task->_running || (task->_type == Task::Type::ONCE && !task->_paused && task->enabled()))
+      return false;
+  return true;
+}
+
+bool Mycila::TaskManager::_park() {
+  // keep looping to let the ONCE tasks run until the drain deadline
+  if (esp_timer_get_time() < _drainUntil && !_drained())
+    return true;
+  if (_wdt)
+    esp_task_wdt_delete(NULL);
+  _parked.fetch_add(1, std::memory_order_acq_rel);
+  if (_asyncRequest.load(std::memory_order_acquire) == AsyncRequest::STOP) {
+    // stopped from one of its own tasks: the last one to stop deletes the other ones before cleaning up,
+    // once they cannot touch the task manager anymore
+    const uint8_t tasks = _asyncTasks();
+    if (_stopped.fetch_add(1, std::memory_order_acq_rel) + 1 < tasks) {
+      while (true)
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    if (_workers) {
+      const TaskHandle_t current = xTaskGetCurrentTaskHandle();
+      for (uint8_t i = 0; i < _workerCount; i++) {
+        if (_workers[i].handle && _workers[i].handle != current) {
+          LOGD(TAG, "Stopping worker %" PRIu8 " of task manager '%s' with handle: %p", i, _name, _workers[i].handle);
+          vTaskDelete(_workers[i].handle);
+        }
+      }
+    }
+    _asyncClear();
+    return false;
+  }
+  _applyMoves();
+  while (_asyncRequest.load(std::memory_order_acquire) == AsyncRequest::SUSPEND) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (_outgoingTasks.load(std::memory_order_relaxed) || _incomingTasks.load(std::memory_order_relaxed) || _hasCompleted())
+      _applyMoves();
+  }
+  _parked.fetch_sub(1, std::memory_order_acq_rel);
+  if (_wdt)
+    esp_task_wdt_add(NULL);
+  // stopped from one of its own tasks, or resumed
+  return _asyncRequest.load(std::memory_order_acquire) == AsyncRequest::NONE || _park();
+}
+
+void Mycila::TaskManager::_applyMoves() {
+  if (_dispatching.exchange(true, std::memory_order_acquire))
+    return;
+  _dispatcher = xTaskGetCurrentTaskHandle();
+  if (_workers && _parked.load(std::memory_order_acquire) >= _asyncTasks()) {
+    // all the workers are parked: the tasks left in their queues are dispatched again once resumed
+    for (uint8_t i = 0; i < _workerCount; i++) {
+      Worker& worker = _workers[i];
+      portENTER_CRITICAL(&worker.lock);
+      for (uint16_t j = 0; j < worker.count; j++)
+        worker.queue[(worker.head + j) % worker.capacity]->_queued = false;
+      worker.count = 0;
+      portEXIT_CRITICAL(&worker.lock);
+    }
+  }
+  if (_outgoingTasks.load(std::memory_order_relaxed) || _incomingTasks.load(std::memory_order_relaxed))
+    _loopMoves();
+  // the offloaded runs finished while suspended are still collected on a task of the task manager
+  if (_hasCompleted())
+    _loopCompleted();
+  _dispatcher = NULL;
+  _dispatching.store(false, std::memory_order_release);
+}
+
+void Mycila::TaskManager::_asyncClear() {
+  if (_workers) {
+    for (uint8_t i = 0; i < _workerCount; i++)
+      for (uint16_t j = 0; j < _workers[i].count; j++)
+        _workers[i].queue[(_workers[i].head + j) % _workers[i].capacity]->_queued = false;
+    delete[] _workers;
+    _workers = nullptr;
+    _workerCount = 0;
+    _dispatching = false;
+  }
   _taskManagerHandle = NULL;
+  _parked.store(0, std::memory_order_relaxed);
+  _stopped.store(0, std::memory_order_relaxed);
+  _asyncRequest.store(AsyncRequest::NONE, std::memory_order_release);
+  // the removals queued meanwhile are not left waiting for the next loop() pass
+  if (_outgoingTasks.load(std::memory_order_relaxed) || _incomingTasks.load(std::memory_order_relaxed))
+    _loopMoves();
+}
+
+void Mycila::TaskManager::_asyncWorker(void* params) {
+  Worker* worker = reinterpret_cast<Worker*>(params);
+  TaskManager* taskManager = worker->manager;
+  int64_t fedAt = 0;
+  while (!taskManager->_taskManagerHandle)
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  while (true) {
+    if (taskManager->_wdt)
+      taskManager->_feedWDT(fedAt);
+    const size_t executed = taskManager->_workerLoop(*worker);
+    if (taskManager->_asyncRequest.load(std::memory_order_acquire) != AsyncRequest::NONE && !taskManager->_park())
+      break;
+    if (!executed) {
+      if (taskManager->_sleepUntilDue)
+        taskManager->_sleep();
+      else if (taskManager->_delay)
+        ulTaskNotifyTake(pdTRUE, (taskManager->_delay + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+      else
+        yield();
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+size_t Mycila::TaskManager::_workerLoop(Worker& worker) {
+  // only one worker at a time looks for the due tasks and spreads them over the workers
+  if (!_dispatching.exchange(true, std::memory_order_acquire)) {
+    _dispatcher = worker.handle;
+    if (_outgoingTasks.load(std::memory_order_relaxed) || _incomingTasks.load(std::memory_order_relaxed))
+      _loopMoves();
+    if (_reprioritized.load(std::memory_order_relaxed))
+      _loopPriorities();
+#ifndef MYCILA_TASK_MANAGER_NO_ADAPTIVE
+    if (_adaptivePeriodUs && esp_timer_get_time() - _adaptedAt >= _adaptivePeriodUs)
+      _adapt();
+#endif
+    if (_hasCompleted())
+      _loopCompleted();
+
+    Task* task = _triggeredTasks.exchange(nullptr, std::memory_order_acquire);
+    while (task) {
+      Task* next = task->_nextTriggered;
+      task->_nextTriggered = nullptr;
+      task->_triggered = false;
+      if (task->_manager == this) {
+        task->resume();
+        task->_requestEarlyRun();
+        _dispatch(*task);
+      }
+      task = next;
+    }
+
+    if (_scheduler == Scheduler::DEADLINE) {
+      _popDue(esp_timer_get_time());
+      for (Task* due : _due) {
+        if (!due || due->_manager != this)
+          continue;
+        if (due->shouldRun())
+          _dispatch(*due);
+        else
+          _reschedule(*due);
+      }
+    } else {
+      for (Task* t : _tasks)
+        if (t->shouldRun())
+          _dispatch(*t);
+    }
+
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+    if (_scheduleEnabled && _scheduleDirty.load(std::memory_order_relaxed))
+      _refreshSchedule();
+#endif
+
+    _dispatcher = NULL;
+    _dispatching.store(false, std::memory_order_release);
+  }
+
+  size_t executed = 0;
+  Task* task;
+  while ((task = _takeWork(worker))) {
+    if (task->tryRun()) {
+      executed++;
+    } else {
+      _reschedule(*task);
+    }
+    task->_queued = false;
+    yield();
+  }
+  return executed;
+}
+
+void Mycila::TaskManager::_dispatch(Task& task) {
+  if (task._queued.exchange(true)) {
+    // already queued or running on a worker: it will be put back in the heap once done
+    _reschedule(task);
+    return;
+  }
+  // the next worker in turn, or the following ones if its queue is full
+  for (uint8_t i = 0; i < _workerCount; i++) {
+    Worker& worker = _workers[_nextWorker++ % _workerCount];
+    portENTER_CRITICAL(&worker.lock);
+    const bool queued = worker.count < worker.capacity;
+    if (queued)
+      worker.queue[(worker.head + worker.count++) % worker.capacity] = &task;
+    portEXIT_CRITICAL(&worker.lock);
+    if (queued) {
+      if (worker.handle != xTaskGetCurrentTaskHandle())
+        xTaskNotifyGive(worker.handle);
+      return;
+    }
+  }
+  // all the queues are full: the task waits for the next pass
+  task._queued = false;
+  _reschedule(task);
+}
+
+bool Mycila::TaskManager::_unqueue(Task& task) {
+  for (uint8_t i = 0; i < _workerCount; i++) {
+    Worker& worker = _workers[i];
+    portENTER_CRITICAL(&worker.lock);
+    uint16_t j = 0;
+    while (j < worker.count && worker.queue[(worker.head + j) % worker.capacity] != &task)
+      j++;
+    const bool found = j < worker.count;
+    if (found) {
+      for (; j + 1 < worker.count; j++)
+        worker.queue[(worker.head + j) % worker.capacity] = worker.queue[(worker.head + j + 1) % worker.capacity];
+      worker.count--;
+    }
+    portEXIT_CRITICAL(&worker.lock);
+    if (found) {
+      task._queued = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+Mycila::Task* Mycila::TaskManager::_takeWork(Worker& worker) {
+  Task* task = nullptr;
+  // take the oldest task of our own queue first
+  portENTER_CRITICAL(&worker.lock);
+  if (worker.count) {
+    task = worker.queue[worker.head];
+    worker.head = (worker.head + 1) % worker.capacity;
+    worker.count--;
+  }
+  portEXIT_CRITICAL(&worker.lock);
+  // otherwise steal the newest task of another worker
+  for (uint8_t i = 1; !task && i < _workerCount; i++) {
+    Worker& victim = _workers[(worker.index + i) % _workerCount];
+    portENTER_CRITICAL(&victim.lock);
+    if (victim.count) {
+      victim.count--;
+      task = victim.queue[(victim.head + victim.count) % victim.capacity];
+    }
+    portEXIT_CRITICAL(&victim.lock);
+  }
+  return task;
+}
+
+#ifndef MYCILA_TASK_MANAGER_NO_TIMEOUTS
+bool Mycila::TaskManager::enableTimeoutMonitor(uint32_t checkMillis) {
+  disableTimeoutMonitor();
+  esp_timer_create_args_t args = {};
+  args.callback = [](void* arg) { reinterpret_cast<TaskManager*>(arg)->checkTimeouts(); };
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = _name;
+  if (esp_timer_create(&args, &_timeoutMonitor) != ESP_OK) {
+    _timeoutMonitor = nullptr;
+    return false;
+  }
+  if (esp_timer_start_periodic(_timeoutMonitor, static_cast<uint64_t>(checkMillis) * 1000) != ESP_OK) {
+    disableTimeoutMonitor();
+    return false;
+  }
+  return true;
+}
+
+void Mycila::TaskManager::disableTimeoutMonitor() {
+  if (!_timeoutMonitor)
+    return;
+  esp_timer_stop(_timeoutMonitor);
+  esp_timer_delete(_timeoutMonitor);
+  _timeoutMonitor = nullptr;
 }
 
+size_t Mycila::TaskManager::checkTimeouts() {
+  // the tasks are only read while the list is locked, so they are reported outside with their name
+  struct Late {
+      const char* name;
+      uint32_t elapsedUs;
+      uint32_t timeoutUs;
+  };
+  Late late[4];
+  size_t count = 0;
+  const uint32_t now = esp_timer_get_time();
+  _tasks.lock();
+  for (Task* task : _tasks) {
+    if (!task->_timeoutUs || !task->_running || task->_timedOut.load(std::memory_order_relaxed))
+      continue;
+    const uint32_t elapsedUs = now - task->_startedAt.load(std::memory_order_relaxed);
+    if (elapsedUs > task->_timeoutUs) {
+      task->_timedOut.store(true, std::memory_order_relaxed);
+      task->_timeouts.fetch_add(1, std::memory_order_relaxed);
+      if (count < sizeof(late) / sizeof(late[0]))
+        late[count] = {task->_name, elapsedUs, task->_timeoutUs};
+      count++;
+    }
+  }
+  _tasks.unlock();
+  for (size_t i = 0; i < count && i < sizeof(late) / sizeof(late[0]); i++)
+    LOGE(TAG, "Task '%s' of task manager '%s' is running for %" PRIu32 " ms: timeout is %" PRIu32 " ms", late[i].name, _name, late[i].elapsedUs / 1000, late[i].timeoutUs / 1000);
+  return count;
+}
+#endif
+
 bool Mycila::TaskManager::configureWDT(uint32_t timeoutSeconds, bool panic) {
   LOGI(TAG, "Configuring Task Watchdog Timer (TWDT) to %" PRIu32 " seconds", timeoutSeconds);
 #if ESP_IDF_VERSION_MAJOR < 5
@@ -94,38 +1328,655 @@ bool Mycila::TaskManager::configureWDT(uint32_t timeoutSeconds, bool panic) {
 }
 
 Mycila::Task::~Task() {
-  if (_stats)
-    delete _stats;
+  // a task added from another FreeRTOS task may not have joined its task manager yet
+  TaskManager* manager = _manager ? _manager : _moveTo.load(std::memory_order_acquire);
+  if (manager)
+    manager->removeTask(*this);
+#ifndef MYCILA_TASK_MANAGER_NO_OFFLOADING
+  _stopOffload();
+#endif
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+  delete _stats.load();
+  delete _retiredStats;
+  delete _windowedStats.load();
+  delete _retiredWindowedStats;
+  delete _latencyStats.load();
+  delete _retiredLatencyStats;
+#endif
 }
 
-Mycila::Task& Mycila::Task::setEnabled(bool enabled) {
-  if (_enabled) {
-    _enabled = nullptr;
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+void Mycila::Task::enableProfiling(uint8_t binCount, uint32_t unitDivider, BinStatistics::Unit unit) {
+  enableStatistics(_stats, _retiredStats, binCount, unitDivider, unit);
+}
+
+void Mycila::Task::disableProfiling() { disableStatistics(_stats, _retiredStats); }
+
+void Mycila::Task::enableWindowedProfiling(uint8_t windowCount, uint32_t windowMillis, uint8_t binCount, uint32_t unitDivider, BinStatistics::Unit unit) {
+  enableWindowedStatistics(_windowedStats, _retiredWindowedStats, windowCount, windowMillis, binCount, unitDivider, unit);
+}
+
+void Mycila::Task::disableWindowedProfiling() { disableWindowedStatistics(_windowedStats, _retiredWindowedStats); }
+
+void Mycila::Task::enableLatencyProfiling(uint8_t binCount, uint32_t unitDivider, BinStatistics::Unit unit) {
+  enableStatistics(_latencyStats, _retiredLatencyStats, binCount, unitDivider, unit);
+}
+
+void Mycila::Task::disableLatencyProfiling() { disableStatistics(_latencyStats, _retiredLatencyStats); }
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_OFFLOADING
+Mycila::Task& Mycila::Task::setExecution(Execution execution, uint32_t stackSize, BaseType_t coreID, BaseType_t priority) {
+  _stopOffload();
+  if (execution == Execution::INLINE)
+    return *this;
+
+  if (coreID < 0)
+    coreID = xPortGetCoreID();
+
+  UBaseType_t prio = priority < 0 ? uxTaskPriorityGet(NULL) : priority;
+  TaskHandle_t handle = NULL;
+  if (xTaskCreateUniversal(_asyncOffload, _name, stackSize, this, prio, &handle, coreID) != pdPASS) {
+    LOGE(TAG, "Task '%s' failed to start offloaded: it will run inline", _name);
+    return *this;
+  }
+  _offloadHandle = handle;
+  LOGD(TAG, "Task '%s' offloaded: core: %d, priority: %" PRIu32 ", stack: %" PRIu32 ", handle: %p", _name, coreID, prio, stackSize, handle);
+  return *this;
+}
+
+void Mycila::Task::_offload(int64_t now) {
+  _offloadStart = now;
+  // not in the heap until the run is collected
+  _manager->_unschedule(*this);
+  xTaskNotifyGive(_offloadHandle.load(std::memory_order_relaxed));
+}
+
+void Mycila::Task::_stopOffload() {
+  TaskHandle_t handle = _offloadHandle.load(std::memory_order_relaxed);
+  if (!handle)
+    return;
+  assert(handle != xTaskGetCurrentTaskHandle());
+  if (_manager)
+    _manager->_waitCompleted(*this);
+  // the FreeRTOS task clears the handle when it does not use this task anymore
+  _offloadStop = true;
+  xTaskNotifyGive(handle);
+  while (_offloadHandle.load(std::memory_order_acquire))
+    vTaskDelay(1);
+  _offloadStop = false;
+  LOGD(TAG, "Task '%s' not offloaded anymore", _name);
+}
+
+void Mycila::Task::_asyncOffload(void* params) {
+  Task* task = reinterpret_cast<Task*>(params);
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (task->_offloadStop)
+      break;
+    task->_fn(task->_params);
+    task->_offloadEnd = esp_timer_get_time();
+    // the task manager cannot remove the task before its run is collected
+    TaskManager* manager = task->_manager;
+    TaskHandle_t handle = manager->_taskManagerHandle;
+    manager->_pushCompleted(*task);
+    if (handle)
+      xTaskNotifyGive(handle);
+  }
+  task->_offloadHandle.store(NULL, std::memory_order_release);
+  vTaskDelete(NULL);
+}
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_DEPENDENCIES
+Mycila::Task& Mycila::Task::then(Task& next, bool forwardData) {
+  assert(next._dependencies < 32);
+  _successors.push_back({&next, static_cast<uint32_t>(1) << next._dependencies++, forwardData});
+  return *this;
+}
+
+void Mycila::Task::_release() {
+  for (const Successor& successor : _successors) {
+    Task* next = successor.task;
+    const uint32_t all = next->_dependencies == 32 ? UINT32_MAX : (static_cast<uint32_t>(1) << next->_dependencies) - 1;
+    uint32_t done = next->_dependenciesDone.fetch_or(successor.bit, std::memory_order_acq_rel) | successor.bit;
+    // only the last dependency done releases the next task
+    if (done != all || !next->_dependenciesDone.compare_exchange_strong(done, 0, std::memory_order_acq_rel))
+      continue;
+    if (successor.forwardData)
+      next->_params = _params;
+    next->trigger();
+  }
+}
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_COALESCING
+void Mycila::Task::_coalesce() {
+  const int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&coalescingLock);
+  if (_pending) {
+    _coalesced.fetch_add(1, std::memory_order_relaxed);
   } else {
-    _enabled = PREDICATE_FALSE;
+    _firstRequest = now;
   }
+  if (_pending < UINT16_MAX)
+    _pending++;
+  int64_t due = _maxPending && _pending >= _maxPending ? now : _firstRequest + _maxLatencyUs;
+  if (_lastRun)
+    due = std::max(due, _lastRun + _minSpacingUs);
+  // a task already due (never run, or early run requested) stays due now, and the next due time is kept if it comes first
+  if (_lastEnd && now - _lastEnd < _intervalUs && _lastEnd + _intervalUs > due)
+    _lastEnd = due > now ? due - _intervalUs : 0;
+  portEXIT_CRITICAL(&coalescingLock);
+}
+
+void Mycila::Task::_coalesceDone(int64_t end) {
+  portENTER_CRITICAL(&coalescingLock);
+  _pending = 0;
+  _lastRun = end;
+  portEXIT_CRITICAL(&coalescingLock);
+}
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_ADAPTIVE
+Mycila::Task& Mycila::Task::setAdaptiveInterval(uint32_t minMillis, uint32_t maxMillis) {
+  _minIntervalUs = static_cast<int64_t>(minMillis) * 1000;
+  _maxIntervalUs = static_cast<int64_t>(std::max(minMillis, maxMillis)) * 1000;
+  if (_maxIntervalUs)
+    setIntervalMicros(std::min(std::max(_intervalUs, _minIntervalUs), _maxIntervalUs));
   return *this;
 }
+#endif
 
-Mycila::Task& Mycila::Task::log() {
-  if (!_stats)
+Mycila::Task& Mycila::Task::setPriority(uint8_t priority) {
+  if (_priority == priority)
+    return *this;
+  _priority = priority;
+  TaskManager* manager = _manager;
+  if (!manager)
     return *this;
+  // the list cannot change while the task manager goes through it, even from a task run by loop()
+  _reprioritized.store(true, std::memory_order_relaxed);
+  manager->_reprioritized.store(true, std::memory_order_release);
+  manager->_wakeUp();
+  return *this;
+}
 
-  const uint8_t binCount = _stats->bins();
-  const uint32_t count = _stats->count();
+void Mycila::TaskManager::_loopPriorities() {
+  _reprioritized.exchange(false, std::memory_order_acquire);
+  for (Task* task : _tasks) {
+    if (task->_reprioritized.exchange(false, std::memory_order_relaxed)) {
+      _tasks.remove(task);
+      _tasks.insert(task);
+#ifndef MYCILA_TASK_MANAGER_NO_BINARY
+      _generation++;
+#endif
+    }
+  }
+}
 
-  if (!binCount || !count)
-    return *this;
+Mycila::Task& Mycila::Task::setEnabled(bool enabled) {
+#ifndef MYCILA_TASK_MANAGER_NO_PREDICATES
+  _enabled = nullptr;
+#endif
+  _enabledState = enabled;
+  _reschedule();
+  _wakeUp();
+  return *this;
+}
 
-  std::string line;
-  line.reserve(192);
-  for (uint8_t i = 0; i < binCount; i++) {
-    line += " | ";
-    line += std::to_string(_stats->bin(i));
-    line += (i < binCount - 1 ? " < 2^" : " >= 2^");
-    line += std::to_string(i < binCount - 1 ? (i + 1) : i);
+#ifndef MYCILA_TASK_MANAGER_NO_PREDICATES
+Mycila::Task& Mycila::Task::setEnabledWhen(Predicate predicate, uint32_t recheckMillis) {
+  _enabled = predicate;
+  _enabledState = true;
+  _checkedAt = 0;
+  _recheckUs = static_cast<int64_t>(recheckMillis) * 1000;
+  _reschedule();
+  _wakeUp();
+  return *this;
+}
+#endif
+
+bool Mycila::Task::trigger() {
+  TaskManager* manager = _manager;
+  if (!manager || _triggered.exchange(true))
+    return false;
+  manager->_pushTriggered(*this);
+  if (manager->_taskManagerHandle && xTaskGetCurrentTaskHandle() != manager->_taskManagerHandle)
+    xTaskNotifyGive(manager->_taskManagerHandle);
+  return true;
+}
+
+bool IRAM_ATTR Mycila::Task::triggerFromISR() {
+  TaskManager* manager = _manager;
+  if (!manager || _triggered.exchange(true))
+    return false;
+  manager->_pushTriggered(*this);
+  if (manager->_taskManagerHandle) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(manager->_taskManagerHandle, &woken);
+    if (woken == pdTRUE)
+      portYIELD_FROM_ISR();
+  }
+  return true;
+}
+
+bool Mycila::Task::moveTo(TaskManager& taskManager) {
+  TaskManager* expected = nullptr;
+  if (_owned || !_moveTo.compare_exchange_strong(expected, &taskManager, std::memory_order_acq_rel))
+    return false;
+  TaskManager* manager = _manager;
+  if (manager == &taskManager) {
+    _moveTo.store(nullptr, std::memory_order_release);
+    return true;
+  }
+  // the source hands the task over to the destination once it is not running anymore
+  TaskManager* next = manager ? manager : &taskManager;
+  TaskManager::_pushMoving(manager ? manager->_outgoingTasks : taskManager._incomingTasks, *this);
+  next->_wakeUp();
+  return true;
+}
+
+void Mycila::TaskManager::_loopMoves() {
+  Task* task = _outgoingTasks.exchange(nullptr, std::memory_order_acquire);
+  while (task) {
+    Task* next = task->_nextMoving;
+    task->_nextMoving = nullptr;
+    if (task->_manager != this) {
+      // removed meanwhile
+      task->_moveTo.store(nullptr, std::memory_order_release);
+    } else if (task->_running || (task->_queued && !_unqueue(*task)) || (task->_triggered && task->_moveTo.load(std::memory_order_relaxed) != this)) {
+      // wait for the run, or the trigger of a moved task, to be done here
+      _pushMoving(_outgoingTasks, *task);
+    } else {
+      TaskManager* to = task->_moveTo.load(std::memory_order_relaxed);
+      if (task->_triggered)
+        _untrigger(*task);
+      _detach(*task);
+      _tasks.remove(task);
+      if (to == this) {
+        // removed by _queueRemove(), which is waiting for it
+        task->_moveTo.store(nullptr, std::memory_order_release);
+      } else {
+        _pushMoving(to->_incomingTasks, *task);
+        to->_wakeUp();
+      }
+    }
+    task = next;
   }
-  line += " |";
-  LOGI(TAG, "| %30s%s count=%" PRIu32, _name, line.c_str(), count);
+
+  // reverse the stack to add the tasks in the order they were moved
+  task = _incomingTasks.exchange(nullptr, std::memory_order_acquire);
+  Task* ordered = nullptr;
+  while (task) {
+    Task* next = task->_nextMoving;
+    task->_nextMoving = ordered;
+    ordered = task;
+    task = next;
+  }
+  while (ordered) {
+    task = ordered;
+    ordered = task->_nextMoving;
+    task->_nextMoving = nullptr;
+    if (!task->_manager) {
+      _tasks.insert(task);
+      _attach(*task);
+    }
+    task->_moveTo.store(nullptr, std::memory_order_release);
+  }
+}
+
+void Mycila::TaskManager::_queueAdd(Task& task) {
+  TaskManager* expected = nullptr;
+  const bool queued = task._moveTo.compare_exchange_strong(expected, this, std::memory_order_acq_rel);
+  assert(queued);
+  (void)queued;
+  _pushMoving(_incomingTasks, task);
+  _notify();
+}
+
+void Mycila::TaskManager::_queueRemove(Task& task) {
+  // wait for an add or a move of the task in progress to be done
+  TaskManager* expected = nullptr;
+  while (!task._moveTo.compare_exchange_weak(expected, this, std::memory_order_acq_rel)) {
+    expected = nullptr;
+    // from a task of a worker, which may be the only one left to apply the moves
+    if (!_remote())
+      _applyMoves();
+    vTaskDelay(1);
+  }
+  if (task._manager != this) {
+    task._moveTo.store(nullptr, std::memory_order_release);
+    return;
+  }
+  _pushMoving(_outgoingTasks, task);
+  _notify();
+  while (task._moveTo.load(std::memory_order_acquire) == this) {
+    if (!_remote())
+      _applyMoves();
+    if (task._moveTo.load(std::memory_order_acquire) == this)
+      vTaskDelay(1);
+  }
+  if (task._owned) {
+    task.~Task();
+    _releaseTask(&task);
+  }
+}
+
+#ifndef MYCILA_TASK_MANAGER_NO_BINARY
+void Mycila::TaskManager::toBinary(Print& out, bool delta) {
+  // the tasks are only known by their position in a delta export
+  if (_exportedGeneration != _generation)
+    delta = false;
+  _exportedGeneration = _generation;
+  out.write(static_cast<uint8_t>(BINARY_VERSION));
+  out.write(static_cast<uint8_t>(delta ? 1 : 0));
+  out.write(static_cast<uint8_t>(sizeof(BinStatistics::Counter)));
+  if (!delta)
+    writeName(out, _name);
+  writeStatistics(out, statistics(), delta);
+  writeVarint(out, _tasks.size());
+  for (Task* task : _tasks)
+    task->toBinary(out, delta);
+}
+
+void Mycila::Task::toBinary(Print& out, bool delta) {
+  uint8_t flags = 0;
+  if (_type == Type::ONCE)
+    flags |= 1;
+  if (_paused)
+    flags |= 2;
+  if (enabled())
+    flags |= 4;
+  if (_running)
+    flags |= 8;
+  if (_scheduling != Scheduling::FIXED_DELAY)
+    flags |= 16;
+  if (coalescing())
+    flags |= 32;
+  if (execution() == Execution::OFFLOADED)
+    flags |= 64;
+  out.write(flags);
+  if (!delta)
+    writeName(out, _name);
+  writeVarint(out, _priority);
+  writeVarint(out, interval());
+  const uint32_t missed = missedDeadlines();
+  const uint32_t overruns = this->overruns();
+  const uint32_t coalesced = this->coalesced();
+  writeVarint(out, missed - (delta ? _exportedMissed : 0));
+  writeVarint(out, overruns - (delta ? _exportedOverruns : 0));
+  writeVarint(out, coalesced - (delta ? _exportedCoalesced : 0));
+  _exportedMissed = missed;
+  _exportedOverruns = overruns;
+  _exportedCoalesced = coalesced;
+  writeStatistics(out, statistics(), delta);
+  writeStatistics(out, latencyStatistics(), delta);
+}
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+float Mycila::Task::utilization() const {
+  if (!_manager || !_manager->_overheadStart)
+    return 0;
+  const int64_t elapsed = (_manager->_overheadEnd ? _manager->_overheadEnd : esp_timer_get_time()) - _manager->_overheadStart;
+  return elapsed > 0 ? 100.0f * busyMicros() / elapsed : 0;
+}
+#endif
+
+Mycila::Task& Mycila::Task::log() {
+  printTask(nullptr, *this);
+  return *this;
+}
+
+Mycila::Task& Mycila::Task::log(Print& out) {
+  printTask(&out, *this);
   return *this;
 }
+
+void Mycila::Task::toJson(Print& out) const {
+  out.print("{\"name\":");
+  printJsonString(out, _name);
+  out.print(",\"type\":");
+  out.print(_type == Type::ONCE ? "\"ONCE\"" : "\"FOREVER\"");
+  out.print(",\"priority\":");
+  out.print(static_cast<unsigned>(_priority));
+  if (_scheduling != Scheduling::FIXED_DELAY) {
+    out.print(",\"missed\":");
+    out.print(missedDeadlines());
+  }
+  out.print(",\"overruns\":");
+  out.print(overruns());
+  if (timeout()) {
+    out.print(",\"timeouts\":");
+    out.print(timeouts());
+  }
+  if (coalescing()) {
+    out.print(",\"coalesced\":");
+    out.print(coalesced());
+  }
+  out.print(",\"paused\":");
+  out.print(_paused ? "true" : "false");
+  out.print(",\"enabled\":");
+  out.print(enabled() ? "true" : "false");
+  out.print(",\"interval\":");
+  out.print(interval());
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+  if (_overheadProfiling) {
+    out.print(",\"busy\":");
+    out.print(busyMicros());
+    out.print(",\"predicates\":");
+    out.print(predicateMicros());
+    out.print(",\"cpu\":");
+    out.print(utilization());
+  }
+#endif
+  printStatisticsJson(out, "stats", statistics());
+  printWindowsJson(out, windowedStatistics());
+  printStatisticsJson(out, "latency", latencyStatistics());
+  out.print('}');
+}
+
+void Mycila::TaskManagerGroup::addTaskManager(TaskManager& taskManager) {
+  if (!_find(&taskManager))
+    _managers.push_back({&taskManager, 0, 0, 0, 0});
+}
+
+Mycila::TaskManagerGroup::Manager* Mycila::TaskManagerGroup::_find(const TaskManager* taskManager) {
+  for (Manager& manager : _managers)
+    if (manager.manager == taskManager)
+      return &manager;
+  return nullptr;
+}
+
+bool Mycila::TaskManagerGroup::addTask(Task& task) {
+  if (_managers.empty())
+    return false;
+  for (const Member& member : _members)
+    if (member.task == &task)
+      return true;
+  for (Manager& manager : _managers)
+    manager.tasks = 0;
+  for (const Member& member : _members) {
+    Manager* manager = _find(member.manager);
+    if (manager)
+      manager->tasks++;
+  }
+  Manager* target = &_managers[0];
+  for (Manager& manager : _managers) {
+    // already in the group
+    if (manager.manager == task._manager) {
+      target = &manager;
+      break;
+    }
+    if (manager.tasks < target->tasks)
+      target = &manager;
+  }
+  if (!task.moveTo(*target->manager))
+    return false;
+  _members.push_back({&task, target->manager, 0, 0});
+  return true;
+}
+
+void Mycila::TaskManagerGroup::removeTask(Task& task) {
+  _members.erase(std::remove_if(_members.begin(), _members.end(), [&task](const Member& member) { return member.task == &task; }), _members.end());
+}
+
+// total time of the runs recorded, in microseconds
+// time spent running as per statistics in microseconds, or UINT64_MAX: the ones in milliseconds truncate each run
+static uint64_t busyMicros(const Mycila::BinStatistics* stats) {
+  return stats && stats->unit() == Mycila::BinStatistics::Unit::MICROSECONDS ? stats->sum() : UINT64_MAX;
+}
+
+// time spent running by a task, as per its overhead profiling or its statistics
+static uint64_t busyMicros(const Mycila::Task& task) {
+  if (task.busyMicros())
+    return task.busyMicros();
+  const Mycila::BinStatistics* stats = task.statistics();
+  if (!stats)
+    return 0;
+  const uint64_t busy = busyMicros(stats);
+  return busy == UINT64_MAX ? stats->sum() * 1000 : busy;
+}
+
+// time since the previous measure, or since the statistics were cleared
+static uint64_t since(uint64_t& previous, uint64_t busy) {
+  const uint64_t load = busy >= previous ? busy - previous : busy;
+  previous = busy;
+  return load;
+}
+
+Mycila::Task* Mycila::TaskManagerGroup::rebalance() {
+  for (Manager& manager : _managers)
+    manager.tasksLoad = 0;
+  for (Member& member : _members) {
+    member.load = since(member.busy, busyMicros(*member.task));
+    // the task may have been moved or removed by hand
+    TaskManager* at = member.task->_moveTo.load(std::memory_order_acquire);
+    member.manager = at ? at : member.task->_manager;
+    Manager* manager = _find(member.manager);
+    if (manager)
+      manager->tasksLoad += member.load;
+  }
+  for (Manager& manager : _managers) {
+    const uint64_t busy = manager.manager->_measuredBusy();
+    manager.load = busy == UINT64_MAX ? manager.tasksLoad : since(manager.busy, busy);
+  }
+  if (_managers.size() < 2)
+    return nullptr;
+
+  Manager* busiest = &_managers[0];
+  Manager* idlest = &_managers[0];
+  for (Manager& manager : _managers) {
+    if (manager.load > busiest->load)
+      busiest = &manager;
+    if (manager.load < idlest->load)
+      idlest = &manager;
+  }
+  const uint64_t gap = busiest->load - idlest->load;
+  if (!gap || gap * 100 < busiest->load * _threshold)
+    return nullptr;
+
+  // the task which brings both loads the closest: moving a load L turns the gap into |gap - 2L|
+  Member* best = nullptr;
+  uint64_t bestGap = gap;
+  for (Member& member : _members) {
+    if (member.manager != busiest->manager || !member.load || member.load >= gap || member.task->moving())
+      continue;
+    const uint64_t newGap = gap > 2 * member.load ? gap - 2 * member.load : 2 * member.load - gap;
+    if (newGap < bestGap) {
+      best = &member;
+      bestGap = newGap;
+    }
+  }
+  if (!best || !best->task->moveTo(*idlest->manager))
+    return nullptr;
+  LOGD(TAG, "Group '%s': moving task '%s' from '%s' to '%s'", _name, best->task->name(), busiest->manager->name(), idlest->manager->name());
+  best->manager = idlest->manager;
+  return best->task;
+}
+
+uint64_t Mycila::TaskManagerGroup::load(const TaskManager& taskManager) const {
+  for (const Manager& manager : _managers)
+    if (manager.manager == &taskManager)
+      return manager.load;
+  return 0;
+}
+
+void Mycila::TaskManagerGroup::setAutoRebalance(uint32_t intervalMillis) {
+  if (!intervalMillis || _managers.empty()) {
+    _balancer.setEnabled(false);
+    return;
+  }
+  _balancer.setInterval(intervalMillis);
+  _balancer.setEnabled(true);
+  _balancer.moveTo(*_managers[0].manager);
+}
+
+uint64_t Mycila::TaskManager::_measuredBusy() const {
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+  if (_overheadProfiling)
+    return _taskUs.load();
+#endif
+  return busyMicros(statistics());
+}
+
+#ifndef MYCILA_TASK_MANAGER_NO_ADAPTIVE
+void Mycila::TaskManager::setAdaptiveScheduling(uint32_t periodMillis, uint8_t lowPercent, uint8_t highPercent) {
+  _adaptiveLow = lowPercent;
+  _adaptiveHigh = std::max(lowPercent, highPercent);
+  _adaptedAt = esp_timer_get_time();
+  _adaptiveBusy = _measuredBusy();
+  for (Task* task : _tasks)
+    task->_adaptiveBusy = busyMicros(*task);
+  _adaptivePeriodUs = static_cast<int64_t>(periodMillis) * 1000;
+}
+
+void Mycila::TaskManager::_adapt() {
+  const int64_t now = esp_timer_get_time();
+  const int64_t elapsed = now - _adaptedAt;
+  _adaptedAt = now;
+  const uint64_t busy = _measuredBusy();
+  if (busy == UINT64_MAX || !elapsed)
+    return;
+  const int64_t load = since(_adaptiveBusy, busy);
+  _utilization = 100.0f * load / elapsed;
+
+  for (Task* task : _tasks)
+    if (task->_maxIntervalUs)
+      task->_adaptiveLoad = since(task->_adaptiveBusy, busyMicros(*task));
+
+  if (_utilization > _adaptiveHigh) {
+    // back off the tasks costing the most first, until the time saved covers the excess
+    const uint32_t round = ++_adaptiveRound;
+    int64_t excess = load - elapsed * _adaptiveHigh / 100;
+    while (excess > 0) {
+      Task* costliest = nullptr;
+      for (Task* task : _tasks)
+        if (task->_maxIntervalUs && task->_intervalUs < task->_maxIntervalUs && task->_adaptiveRound != round && (!costliest || task->_adaptiveLoad > costliest->_adaptiveLoad))
+          costliest = task;
+      if (!costliest)
+        break;
+      costliest->_adaptiveRound = round;
+      const int64_t interval = std::min(costliest->_maxIntervalUs, std::max<int64_t>(costliest->_intervalUs * 2, 1000));
+      excess -= costliest->_adaptiveLoad - costliest->_adaptiveLoad * costliest->_intervalUs / interval;
+      LOGD(TAG, "Task manager '%s' is %.0f%% busy: interval of '%s' set to %" PRIu32 " ms", _name, _utilization, costliest->_name, static_cast<uint32_t>(interval / 1000));
+      costliest->setIntervalMicros(interval);
+    }
+  } else if (_utilization < _adaptiveLow) {
+    // speed up the tasks as long as the expected utilization stays below the high mark
+    int64_t room = elapsed * _adaptiveHigh / 100 - load;
+    for (Task* task : _tasks) {
+      if (!task->_maxIntervalUs || task->_intervalUs <= task->_minIntervalUs)
+        continue;
+      const int64_t interval = std::max(task->_minIntervalUs, task->_intervalUs * 3 / 4);
+      const int64_t more = interval ? task->_adaptiveLoad * task->_intervalUs / interval - task->_adaptiveLoad : 0;
+      if (more > room)
+        continue;
+      room -= more;
+      LOGD(TAG, "Task manager '%s' is %.0f%% busy: interval of '%s' set to %" PRIu32 " ms", _name, _utilization, task->_name, static_cast<uint32_t>(interval / 1000));
+      task->setIntervalMicros(interval);
+    }
+  }
+}
+#endif
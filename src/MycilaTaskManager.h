@@ -4,10 +4,7 @@
  */
 #pragma once
 
-#include <Print.h>
-#include <esp_task_wdt.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
+#include "MycilaTaskManagerPlatform.h"
 
 #ifdef MYCILA_JSON_SUPPORT
   #include <ArduinoJson.h>
@@ -15,9 +12,14 @@
 
 #include "MycilaBinStatistics.h"
 
+#ifdef MYCILA_TASK_MANAGER_INLINE_FUNCTIONS
+  #include "MycilaDelegate.h"
+#endif
+
+#include <atomic>
 #include <functional>
-#include <list>
-#include <memory>
+#include <new>
+#include <vector>
 
 #define MYCILA_TASK_MANAGER_VERSION          "4.0.1"
 #define MYCILA_TASK_MANAGER_VERSION_MAJOR    4
@@ -25,6 +27,9 @@
 #define MYCILA_TASK_MANAGER_VERSION_REVISION 1
 
 namespace Mycila {
+  class TaskManager;
+  class TaskManagerGroup;
+
   class Task {
     public:
       enum class Type {
@@ -34,9 +39,35 @@ namespace Mycila {
         FOREVER
       };
 
+      enum class Execution {
+        // the task runs in the loop() of its task manager
+        INLINE,
+        // the task runs on its own FreeRTOS task: the task manager starts it and collects it once done
+        OFFLOADED
+      };
+
+      enum class Scheduling {
+        // the interval is counted from the end of the previous run: the period includes the execution time (default)
+        FIXED_DELAY,
+        // the interval is counted from the planned start of the previous run, without drift.
+        // When a run starts one interval late or more, the periods missed are skipped.
+        FIXED_RATE_SKIP,
+        // same as FIXED_RATE_SKIP but the runs missed are run back to back until the task is back on schedule
+        FIXED_RATE_BURST
+      };
+
+#ifdef MYCILA_TASK_MANAGER_INLINE_FUNCTIONS
+      // no heap allocation and no type erasure overhead: captures must fit in MYCILA_DELEGATE_SIZE bytes
+      typedef Delegate<void(void* params)> Function;
+      typedef Delegate<void(const Task& me, uint32_t elapsed)> DoneCallback;
+      typedef Delegate<bool()> Predicate;
+      typedef Delegate<void(const Task& me, uint32_t elapsedMicros)> OverrunCallback;
+#else
       typedef std::function<void(void* params)> Function;
       typedef std::function<void(const Task& me, uint32_t elapsed)> DoneCallback;
       typedef std::function<bool()> Predicate;
+      typedef std::function<void(const Task& me, uint32_t elapsedMicros)> OverrunCallback;
+#endif
 
       Task(const char* name, Function fn) : Task(name, Type::FOREVER, fn) {}
 
@@ -57,32 +88,169 @@ namespace Mycila {
         _type = type;
         // if the task is a ONCE task, it starts paused by default
         _paused = _type == Type::ONCE;
+        _reschedule();
         return *this;
       }
       Type type() const { return _type; }
 
-      // change the enabled state
+      // Change where the task runs. An OFFLOADED task runs on a dedicated FreeRTOS task so that a blocking call
+      // (HTTP request, flash write, etc) does not stall the other tasks of the task manager.
+      // The task manager keeps running the other tasks and calls onDone() and records the statistics once the run is finished.
+      // An OFFLOADED task which is not in a task manager runs inline.
+      // - If core ID is not set (-1), then the task will run on the same core as the caller
+      // - If priority is not set (-1), then the task will run with the same priority as the caller
+      // Changing the execution waits for the run in flight: its onDone() callback still runs on the task manager's task.
+      // Do not change the execution or remove the task from the task manager from the task function itself.
+#ifndef MYCILA_TASK_MANAGER_NO_OFFLOADING
+      Task& setExecution(Execution execution, uint32_t stackSize = 4096, BaseType_t coreID = -1, BaseType_t priority = -1);
+      Execution execution() const { return _offloadHandle.load(std::memory_order_relaxed) ? Execution::OFFLOADED : Execution::INLINE; }
+#else
+      Execution execution() const { return Execution::INLINE; }
+#endif
+
+      // change the priority of the task: the due tasks with a higher priority run first in a loop() pass.
+      // Tasks with the same priority run in the order they were added. Default is 0.
+      // In a task manager, the task is moved to its new place at the start of the next loop() pass.
+      Task& setPriority(uint8_t priority);
+      uint8_t priority() const { return _priority; }
+
+      // change the enabled state, and remove the enabled predicate if any.
+      // A disabled task is removed from the deadline scheduler until it is enabled again.
       Task& setEnabled(bool enabled);
-      Task& setEnabledWhen(Predicate predicate) {
-        _enabled = predicate;
+#ifndef MYCILA_TASK_MANAGER_NO_PREDICATES
+      // Enable the task when the predicate is true.
+      // The predicate is checked each time the task could run, or at most every recheckMillis if set: the result is cached meanwhile.
+      Task& setEnabledWhen(Predicate predicate, uint32_t recheckMillis = 0);
+      // force the predicate to be checked the next time the task could run
+      Task& invalidateEnabled() {
+        _checkedAt = 0;
         return *this;
       }
-      // check if a task is enabled as per the enabled predicate. By default a task is enabled.
-      bool enabled() const { return !_enabled || _enabled(); }
+      // check if a task is enabled as per the enabled state or the enabled predicate. By default a task is enabled.
+      bool enabled() const {
+        if (!_enabled)
+          return _enabledState;
+        if (_recheckUs) {
+          const int64_t now = esp_timer_get_time();
+          if (_checkedAt && now - _checkedAt < _recheckUs)
+            return _enabledState;
+          _checkedAt = now;
+        }
+  #ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+        if (_overheadProfiling) {
+          const int64_t start = esp_timer_get_time();
+          _enabledState = _enabled();
+          _predicateUs.add(esp_timer_get_time() - start);
+          return _enabledState;
+        }
+  #endif
+        _enabledState = _enabled();
+        return _enabledState;
+      }
+#else
+      // check if a task is enabled as per the enabled state. By default a task is enabled.
+      bool enabled() const { return _enabledState; }
+#endif
 
       // change the interval of execution
-      Task& setInterval(uint32_t intervalMillis) {
-        _intervalMs = intervalMillis;
+      Task& setInterval(uint32_t intervalMillis) { return setIntervalMicros(static_cast<int64_t>(intervalMillis) * 1000); }
+      // change the interval of execution, in microseconds, for fast control loops
+      Task& setIntervalMicros(int64_t intervalMicros) {
+        _intervalUs = intervalMicros;
+        _reschedule();
+        _wakeUp();
+        return *this;
+      }
+      // change the way the next run is planned
+      Task& setScheduling(Scheduling scheduling) {
+        _scheduling = scheduling;
         return *this;
       }
+      Scheduling scheduling() const { return _scheduling; }
+      // number of runs which did not start within their period with a fixed rate scheduling: skipped with FIXED_RATE_SKIP, late with FIXED_RATE_BURST.
+      // The periods spent paused or disabled are counted too.
+      uint32_t missedDeadlines() const { return _missed.load(std::memory_order_relaxed); }
+
+#ifndef MYCILA_TASK_MANAGER_NO_ADAPTIVE
+      // Let the task manager adapt the interval between minMillis and maxMillis to its load: see TaskManager::setAdaptiveScheduling().
+      // Use it for the tasks which can run less often when the task manager is busy, like a periodic output.
+      // setAdaptiveInterval(0, 0) stops it and keeps the current interval.
+      Task& setAdaptiveInterval(uint32_t minMillis, uint32_t maxMillis);
+      bool adaptiveInterval() const { return _maxIntervalUs; }
+#else
+      bool adaptiveInterval() const { return false; }
+#endif
+
       // task interval in milliseconds
-      uint32_t interval() const { return _intervalMs; }
+      uint32_t interval() const { return _intervalUs / 1000; }
+      // task interval in microseconds
+      int64_t intervalMicros() const { return _intervalUs; }
 
+#ifndef MYCILA_TASK_MANAGER_NO_CALLBACKS
       // callback when the task is done
       Task& onDone(DoneCallback doneCallback) {
         _onDone = doneCallback;
         return *this;
       }
+#endif
+
+      // Set the execution time budget of the task in microseconds: a run longer than that is an overrun.
+      // By default (0), the budget is the interval.
+      Task& setBudget(uint32_t budgetMicros) {
+        _budgetUs = budgetMicros;
+        return *this;
+      }
+      uint32_t budget() const { return _budgetUs; }
+#ifndef MYCILA_TASK_MANAGER_NO_CALLBACKS
+      // callback when a run is longer than the budget, called after onDone()
+      Task& onOverrun(OverrunCallback overrunCallback) {
+        _onOverrun = overrunCallback;
+        return *this;
+      }
+#endif
+      // number of runs longer than the budget
+      uint32_t overruns() const { return _overruns.load(std::memory_order_relaxed); }
+
+#ifndef MYCILA_TASK_MANAGER_NO_TIMEOUTS
+      // Soft watchdog of the task: a run still going after timeoutMillis is reported by the timeout monitor of its task manager,
+      // with the name of the task. 0 disables it (default). See TaskManager::enableTimeoutMonitor().
+      // The run time is measured on 32 bits in microseconds: the timeout is capped to INT32_MAX us (about 35 minutes).
+      Task& setTimeout(uint32_t timeoutMillis) {
+        const uint64_t timeoutUs = static_cast<uint64_t>(timeoutMillis) * 1000;
+        _timeoutUs = timeoutUs > INT32_MAX ? INT32_MAX : timeoutUs;
+        return *this;
+      }
+      uint32_t timeout() const { return _timeoutUs / 1000; }
+      // number of runs which went over the timeout
+      uint32_t timeouts() const { return _timeouts.load(std::memory_order_relaxed); }
+      // check if the current run is over the timeout
+      bool timedOut() const { return _timedOut.load(std::memory_order_relaxed); }
+#else
+      uint32_t timeout() const { return 0; }
+      uint32_t timeouts() const { return 0; }
+      bool timedOut() const { return false; }
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+      // time spent in the task function and in its enabled predicate since TaskManager::enableOverheadProfiling(), in microseconds
+      int64_t busyMicros() const { return _busyUs.load(); }
+      int64_t predicateMicros() const { return _predicateUs.load(); }
+      // share of the time since TaskManager::enableOverheadProfiling() spent in the task function, in percent
+      float utilization() const;
+#else
+      int64_t busyMicros() const { return 0; }
+      int64_t predicateMicros() const { return 0; }
+      float utilization() const { return 0; }
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_DEPENDENCIES
+      // Run the next task as soon as this one is done, in the same loop() pass when both are in the same task manager.
+      // Several tasks can follow the same one (fan-out), and a task following several ones (fan-in) runs once all of them are done.
+      // If forwardData is true, the next task receives the data of this one: the last one done with fan-in.
+      // The next task runs like a triggered task: it is resumed if paused but needs to be enabled.
+      // Both tasks must stay alive as long as the dependency exists. Up to 32 tasks can be followed by a task.
+      Task& then(Task& next, bool forwardData = false); // NOLINT
+#endif
 
       // pass some data to the task
       Task& setData(void* params) {
@@ -94,6 +262,7 @@ namespace Mycila {
       // pause a task
       Task& pause() {
         _paused = true;
+        _reschedule();
         return *this;
       }
       // check is the task is temporary paused
@@ -102,19 +271,23 @@ namespace Mycila {
       // if delayMillis is set, the task will resume after the delay
       Task& resume(uint32_t delayMillis = 0) {
         if (delayMillis) {
-          setInterval(delayMillis);
-          _lastEnd = millis();
+          _intervalUs = static_cast<int64_t>(delayMillis) * 1000;
+          _lastEnd = esp_timer_get_time();
         }
         _paused = false;
+        _reschedule();
+        _wakeUp();
         return *this;
       }
 
       // get remaining time before next run in milliseconds
-      uint32_t remainingTme() const {
-        if (!_intervalMs)
+      uint32_t remainingTme() const { return remainingMicros() / 1000; }
+      // get remaining time before next run in microseconds
+      int64_t remainingMicros() const {
+        if (!_lastEnd)
           return 0;
-        uint32_t diff = millis() - _lastEnd;
-        return diff >= _intervalMs ? 0 : _intervalMs - diff;
+        int64_t diff = esp_timer_get_time() - _lastEnd;
+        return diff >= _intervalUs ? 0 : _intervalUs - diff;
       }
 
       // check if the task is scheduled to be run, meaning it is enabled, not paused and the interval will be reached
@@ -122,107 +295,463 @@ namespace Mycila {
 
       // check if the task should run, meaning it is enabled, not paused and the interval has been reached
       bool shouldRun() const {
-        if (_paused || !enabled())
+        if (_paused || _running || !enabled())
           return false;
-        return _lastEnd == 0 || _intervalMs == 0 || millis() - _lastEnd >= _intervalMs;
+        return _lastEnd == 0 || esp_timer_get_time() - _lastEnd >= _intervalUs;
       }
 
       // try to run the task if it should run
       bool tryRun() {
-        if (_paused || !enabled())
+        if (_paused || _running || !enabled())
           return false;
-        if (_lastEnd == 0 || _intervalMs == 0) {
-          _run(millis());
+        if (_lastEnd == 0) {
+          _run(esp_timer_get_time());
           return true;
         }
-        uint32_t now = millis();
-        if (now - _lastEnd >= _intervalMs) {
+        int64_t now = esp_timer_get_time();
+        if (now - _lastEnd >= _intervalUs) {
           _run(now);
           return true;
         }
         return false;
       }
-      // force the task to run
+      // force the task to run: does nothing while it is running, or while its OFFLOADED run is in flight
       Task& forceRun() {
-        _run(millis());
+        if (!_running)
+          _run(esp_timer_get_time());
         return *this;
       }
-      // check if the task is currently running
+      // check if the task is currently running, or in flight on its own FreeRTOS task when OFFLOADED
       bool running() const { return _running; }
 
       // request an early run of the task and do not wait for the interval to be reached
+      // With coalescing, the requests are batched in a single run.
       Task& requestEarlyRun() {
+#ifndef MYCILA_TASK_MANAGER_NO_COALESCING
+        if (_coalescing)
+          _coalesce();
+        else
+          _lastEnd = 0;
+#else
         _lastEnd = 0;
+#endif
+        _reschedule();
+        _wakeUp();
         return *this;
       }
+#ifndef MYCILA_TASK_MANAGER_NO_COALESCING
       // check if the task is requested to run earlier than its scheduled interval
+      bool earlyRunRequested() const { return _lastEnd == 0 || _pending; }
+
+      // Batch the bursts of requestEarlyRun() in a single run:
+      // - minSpacingMillis: minimum time between the end of a run and an early run
+      // - maxLatencyMillis: time to wait for more requests after the first one of a batch
+      // - maxPending: the early run happens without waiting for maxLatencyMillis once this number of requests is pending (0 for no limit)
+      // setCoalescing(0) disables coalescing. Triggered runs are not coalesced.
+      Task& setCoalescing(uint32_t minSpacingMillis, uint32_t maxLatencyMillis = 0, uint16_t maxPending = 0) {
+        _minSpacingUs = static_cast<int64_t>(minSpacingMillis) * 1000;
+        _maxLatencyUs = static_cast<int64_t>(maxLatencyMillis) * 1000;
+        _maxPending = maxPending;
+        _coalescing = minSpacingMillis || maxLatencyMillis;
+        return *this;
+      }
+      // number of early run requests merged in a run requested before
+      uint32_t coalesced() const { return _coalesced.load(std::memory_order_relaxed); }
+      bool coalescing() const { return _coalescing; }
+#else
       bool earlyRunRequested() const { return _lastEnd == 0; }
+      uint32_t coalesced() const { return 0; }
+      bool coalescing() const { return false; }
+#endif
+
+      // To be called from the task function: the next run will happen delayMillis after the end of this run instead of after the interval.
+      // This is the way resumable tasks wait without blocking the task manager: see MYCILA_TASK_SLEEP().
+      Task& sleep(uint32_t delayMillis) {
+        _sleepUs = static_cast<int64_t>(delayMillis) * 1000;
+        return *this;
+      }
 
+      // Position where a resumable task function resumes on its next run: see MYCILA_TASK_BEGIN(). 0 is the beginning.
+      uint16_t resumePoint() const { return _resumePoint; }
+      Task& setResumePoint(uint16_t resumePoint) {
+        _resumePoint = resumePoint;
+        return *this;
+      }
+
+      // Queue the task to be run as soon as possible by its task manager, which is woken up if it is running async.
+      // A paused task is resumed and its interval is ignored for this run, but it still needs to be enabled.
+      // Can be called from any FreeRTOS task. Returns false if the task is not in a task manager or is already triggered.
+      bool trigger();
+      // same as trigger() but to be called from an interrupt handler
+      bool triggerFromISR();
+      // check if the task is waiting to be run by its task manager after a trigger
+      bool triggered() const { return _triggered; }
+
+      // Move the task to another task manager, usually on another core: see TaskManagerGroup.
+      // The task leaves its task manager at the start of a loop() pass where it is not running, queued or triggered,
+      // and joins the other one at the start of its next loop() pass, so it never runs in both.
+      // Both task managers must be looping for the move to complete. Do not delete or remove the task while it moves.
+      // Can be called from any FreeRTOS task. Returns false if the task was created with newTask() or is already moving.
+      bool moveTo(TaskManager& taskManager); // NOLINT
+      // check if the task is moving to another task manager
+      bool moving() const { return _moveTo.load(std::memory_order_relaxed); }
+
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
       // enable profiling of the task
       // binCount is the number of bins to record the number of iterations in each bin.
       // unitDivider is the divider to se for the unit: 1 for milliseconds, 1000 for seconds, etc
-      void enableProfiling(uint8_t binCount = 10, uint32_t unitDividerMillis = 1) {
-        if (!_stats)
-          _stats = new BinStatistics(binCount, unitDividerMillis);
-      }
-      void disableProfiling() {
-        if (_stats) {
-          delete _stats;
-          _stats = nullptr;
-        }
-      }
+      // unit is the time unit recorded before applying the divider: use MICROSECONDS for tasks running under a millisecond
+      void enableProfiling(uint8_t binCount = 10, uint32_t unitDivider = 1, BinStatistics::Unit unit = BinStatistics::Unit::MILLISECONDS);
+      // Stop profiling. The statistics are kept until profiling is enabled again or the task is deleted,
+      // so that a reader on another core can still use them safely.
+      void disableProfiling();
+
+      bool profiled() const { return _stats.load(std::memory_order_relaxed); }
+      // use BinStatistics::snapshot() to read consistent statistics from another task or core
+      const BinStatistics* statistics() const { return _stats.load(std::memory_order_acquire); }
 
-      bool profiled() const { return _stats; }
-      const BinStatistics* statistics() const { return _stats; }
+      // enable profiling in a ring of time windows, in addition to the statistics since enableProfiling()
+      // windowCount windows of windowMillis each are kept: the others parameters are the ones of enableProfiling()
+      void enableWindowedProfiling(uint8_t windowCount, uint32_t windowMillis, uint8_t binCount = 10, uint32_t unitDivider = 1, BinStatistics::Unit unit = BinStatistics::Unit::MILLISECONDS);
+      void disableWindowedProfiling();
+      const WindowedBinStatistics* windowedStatistics() const { return _windowedStats.load(std::memory_order_acquire); }
+
+      // record the start latency of the runs: the time between the task being due and its run starting.
+      // Early runs and triggered runs, which have no due time, are not recorded.
+      void enableLatencyProfiling(uint8_t binCount = 10, uint32_t unitDivider = 1, BinStatistics::Unit unit = BinStatistics::Unit::MILLISECONDS);
+      void disableLatencyProfiling();
+      const BinStatistics* latencyStatistics() const { return _latencyStats.load(std::memory_order_acquire); }
+#else
+      // profiling is compiled out with MYCILA_TASK_MANAGER_NO_PROFILING: it can be enabled but nothing is recorded
+      void enableProfiling(uint8_t = 10, uint32_t = 1, BinStatistics::Unit = BinStatistics::Unit::MILLISECONDS) {}
+      void disableProfiling() {}
+      bool profiled() const { return false; }
+      const BinStatistics* statistics() const { return nullptr; }
+      void enableWindowedProfiling(uint8_t, uint32_t, uint8_t = 10, uint32_t = 1, BinStatistics::Unit = BinStatistics::Unit::MILLISECONDS) {}
+      void disableWindowedProfiling() {}
+      const WindowedBinStatistics* windowedStatistics() const { return nullptr; }
+      void enableLatencyProfiling(uint8_t = 10, uint32_t = 1, BinStatistics::Unit = BinStatistics::Unit::MILLISECONDS) {}
+      void disableLatencyProfiling() {}
+      const BinStatistics* latencyStatistics() const { return nullptr; }
+#endif
 
+      // log the statistics and counters of the task
       Task& log();
+      // same as log() but the lines are printed to out, without allocating
+      Task& log(Print& out); // NOLINT
+
+      // json output of the task, written to out as it goes: no JSON document or allocation needed
+      void toJson(Print& out) const; // NOLINT
+
+#ifndef MYCILA_TASK_MANAGER_NO_BINARY
+      // Compact binary output of the task: see TaskManager::toBinary().
+      // With delta, the counters and statistics are the differences since the previous export.
+      void toBinary(Print& out, bool delta = false); // NOLINT
+#endif
 
 #ifdef MYCILA_JSON_SUPPORT
       void toJson(const JsonObject& root) const {
         root["name"] = _name;
         root["type"] = _type == Type::ONCE ? "ONCE" : "FOREVER";
+        root["priority"] = _priority;
+        if (_scheduling != Scheduling::FIXED_DELAY)
+          root["missed"] = missedDeadlines();
+        root["overruns"] = overruns();
+        if (timeout())
+          root["timeouts"] = timeouts();
+        if (coalescing())
+          root["coalesced"] = coalesced();
         root["paused"] = _paused;
         root["enabled"] = enabled();
-        root["interval"] = _intervalMs;
-        if (_stats && _stats->bins() && _stats->count())
-          _stats->toJson(root["stats"].to<JsonObject>());
+        root["interval"] = interval();
+  #ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+        if (_overheadProfiling) {
+          root["busy"] = busyMicros();
+          root["predicates"] = predicateMicros();
+          root["cpu"] = utilization();
+        }
+        const BinStatistics* stats = statistics();
+        if (stats && stats->bins() && stats->count())
+          stats->toJson(root["stats"].to<JsonObject>());
+        const WindowedBinStatistics* windowedStats = windowedStatistics();
+        if (windowedStats)
+          windowedStats->toJson(root["windows"].to<JsonArray>());
+        const BinStatistics* latencyStats = latencyStatistics();
+        if (latencyStats && latencyStats->bins() && latencyStats->count())
+          latencyStats->toJson(root["latency"].to<JsonObject>());
+  #endif
       }
 #endif
 
     private:
       const char* _name;
       const Function _fn;
+      TaskManager* _manager = nullptr;
+      // links in the task list of the task manager
+      Task* _prev = nullptr;
+      Task* _next = nullptr;
+      // position in the deadline scheduler of the task manager, or -1
+      int32_t _heapIndex = -1;
+      // created by the task manager with newTask()
+      bool _owned = false;
+      // set when the priority changed and the task has to be moved in the list of its task manager
+      std::atomic<bool> _reprioritized{false};
+      // set while the task is in the list of triggered tasks of the task manager
+      std::atomic<bool> _triggered{false};
+      // set while the task is queued or running on a worker of a task manager pool
+      std::atomic<bool> _queued{false};
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+      // position in the schedule snapshot of the task manager, and whether it has to be updated
+      int32_t _scheduleIndex = -1;
+      std::atomic<bool> _scheduleChanged{false};
+#endif
+      // link in the list of triggered tasks of the task manager
+      Task* _nextTriggered = nullptr;
+      // destination of a move to another task manager, and the link in the list of moving tasks of the source or destination
+      std::atomic<TaskManager*> _moveTo{nullptr};
+      Task* _nextMoving = nullptr;
+
+#ifndef MYCILA_TASK_MANAGER_NO_OFFLOADING
+      // offloaded execution: the FreeRTOS task running the task function, and the link in the list of finished runs of the task manager
+      std::atomic<TaskHandle_t> _offloadHandle{NULL};
+      std::atomic<bool> _offloadStop{false};
+      Task* _nextCompleted = nullptr;
+      int64_t _offloadStart = 0;
+      int64_t _offloadEnd = 0;
+#endif
 
+      // enabled state set by setEnabled(), or last result of the predicate
+      mutable bool _enabledState = true;
+#ifndef MYCILA_TASK_MANAGER_NO_PREDICATES
       Predicate _enabled = nullptr;
+      mutable int64_t _checkedAt = 0;
+      int64_t _recheckUs = 0;
+#endif
       bool _paused = false;
-      bool _running = false;
+      std::atomic<bool> _running{false};
+      uint8_t _priority = 0;
+#ifndef MYCILA_TASK_MANAGER_NO_CALLBACKS
       DoneCallback _onDone = nullptr;
-      Mycila::BinStatistics* _stats = nullptr;
+      OverrunCallback _onOverrun = nullptr;
+#endif
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+      std::atomic<BinStatistics*> _stats{nullptr};
+      // statistics detached by disableProfiling(), kept alive for the readers still using them
+      BinStatistics* _retiredStats = nullptr;
+      std::atomic<WindowedBinStatistics*> _windowedStats{nullptr};
+      WindowedBinStatistics* _retiredWindowedStats = nullptr;
+      std::atomic<BinStatistics*> _latencyStats{nullptr};
+      BinStatistics* _retiredLatencyStats = nullptr;
+      // overhead profiling of the task manager
+      bool _overheadProfiling = false;
+      MicrosCounter _busyUs;
+      mutable MicrosCounter _predicateUs;
+#endif
+#ifndef MYCILA_TASK_MANAGER_NO_DEPENDENCIES
+      // dependencies: the tasks following this one, and the ones this task is waiting for with one bit each
+      struct Successor {
+          Task* task;
+          uint32_t bit;
+          bool forwardData;
+      };
+      std::vector<Successor> _successors;
+      uint8_t _dependencies = 0;
+      std::atomic<uint32_t> _dependenciesDone{0};
+#endif
+      uint32_t _budgetUs = 0;
+      std::atomic<uint32_t> _overruns{0};
+#ifndef MYCILA_TASK_MANAGER_NO_TIMEOUTS
+      // soft watchdog: start of the current run, in microseconds truncated to 32 bits
+      uint32_t _timeoutUs = 0;
+      std::atomic<uint32_t> _startedAt{0};
+      std::atomic<bool> _timedOut{false};
+      std::atomic<uint32_t> _timeouts{0};
+#endif
+#ifndef MYCILA_TASK_MANAGER_NO_BINARY
+      // counters sent by the last binary export
+      uint32_t _exportedMissed = 0;
+      uint32_t _exportedOverruns = 0;
+      uint32_t _exportedCoalesced = 0;
+#endif
       Type _type = Type::FOREVER;
-      uint32_t _intervalMs = 0;
-      uint32_t _lastEnd = 0;
+      Scheduling _scheduling = Scheduling::FIXED_DELAY;
+      std::atomic<uint32_t> _missed{0};
+      // timestamps are in microseconds from esp_timer_get_time(), 0 means an early run is requested
+      int64_t _intervalUs = 0;
+      // the interval is counted from there: end of the previous run, or its planned start with a fixed rate
+      int64_t _lastEnd = 0;
+      // planned start of the current run with a fixed rate
+      int64_t _planned = 0;
+      // delay before the next run requested by sleep(), or -1
+      int64_t _sleepUs = -1;
+#ifndef MYCILA_TASK_MANAGER_NO_ADAPTIVE
+      // adaptive interval: bounds, and the time spent running measured by the task manager
+      int64_t _minIntervalUs = 0;
+      int64_t _maxIntervalUs = 0;
+      uint64_t _adaptiveBusy = 0;
+      uint64_t _adaptiveLoad = 0;
+      uint32_t _adaptiveRound = 0;
+#endif
+      uint16_t _resumePoint = 0;
+#ifndef MYCILA_TASK_MANAGER_NO_COALESCING
+      // coalescing of the early run requests
+      bool _coalescing = false;
+      uint16_t _maxPending = 0;
+      uint16_t _pending = 0;
+      std::atomic<uint32_t> _coalesced{0};
+      int64_t _minSpacingUs = 0;
+      int64_t _maxLatencyUs = 0;
+      int64_t _firstRequest = 0;
+      int64_t _lastRun = 0;
+#endif
       void* _params = nullptr;
 
-      void _run(uint32_t now) {
+      void _run(int64_t now) {
+#ifndef MYCILA_TASK_MANAGER_NO_TIMEOUTS
+        if (_timeoutUs) {
+          _startedAt.store(static_cast<uint32_t>(now), std::memory_order_relaxed);
+          _timedOut.store(false, std::memory_order_relaxed);
+        }
+#endif
         _running = true;
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+        BinStatistics* latencyStats = _latencyStats.load(std::memory_order_relaxed);
+        if (latencyStats && _lastEnd && _intervalUs && now >= _lastEnd + _intervalUs)
+          latencyStats->recordMicros(now - _lastEnd - _intervalUs);
+#endif
+        if (_scheduling != Scheduling::FIXED_DELAY)
+          _plan(now);
+#ifndef MYCILA_TASK_MANAGER_NO_OFFLOADING
+        if (_manager && _offloadHandle.load(std::memory_order_relaxed)) {
+          _offload(now);
+          return;
+        }
+#endif
         _fn(_params);
+        _done(now, esp_timer_get_time());
+      }
+
+      // end of a run started at start
+      void _done(int64_t start, int64_t end) {
         _running = false;
-        _lastEnd = millis();
+        _lastEnd = _scheduling == Scheduling::FIXED_DELAY ? end : _planned;
+        if (_sleepUs >= 0) {
+          // the next due time is _lastEnd + _intervalUs
+          _lastEnd = end + _sleepUs - _intervalUs;
+          _sleepUs = -1;
+        }
+#ifndef MYCILA_TASK_MANAGER_NO_COALESCING
+        if (_coalescing)
+          _coalesceDone(end);
+#endif
         if (_type == Type::ONCE)
           _paused = true;
-        uint32_t elapsed = _lastEnd - now;
-        if (_stats)
-          _stats->record(elapsed);
+        const uint32_t elapsedUs = end - start;
+        _reschedule();
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+        if (_overheadProfiling)
+          _profile(elapsedUs);
+        BinStatistics* stats = _stats.load(std::memory_order_relaxed);
+        if (stats)
+          stats->recordMicros(elapsedUs);
+        WindowedBinStatistics* windowedStats = _windowedStats.load(std::memory_order_relaxed);
+        if (windowedStats)
+          windowedStats->recordMicros(elapsedUs, end / 1000);
+#endif
+#ifndef MYCILA_TASK_MANAGER_NO_CALLBACKS
         if (_onDone)
-          _onDone(*this, elapsed);
+          _onDone(*this, elapsedUs / 1000);
+#endif
+        const int64_t budget = _budgetUs ? _budgetUs : _intervalUs;
+        if (budget && elapsedUs > budget) {
+          _overruns.fetch_add(1, std::memory_order_relaxed);
+#ifndef MYCILA_TASK_MANAGER_NO_CALLBACKS
+          if (_onOverrun)
+            _onOverrun(*this, elapsedUs);
+#endif
+        }
+#ifndef MYCILA_TASK_MANAGER_NO_DEPENDENCIES
+        if (!_successors.empty())
+          _release();
+#endif
+      }
+
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+      // add a run to the overhead profiling of the task manager
+      void _profile(uint32_t elapsedUs);
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_DEPENDENCIES
+      // release the tasks following this one when all their dependencies are done
+      void _release();
+#endif
+
+      // move the next due time for a coalesced early run request
+#ifndef MYCILA_TASK_MANAGER_NO_COALESCING
+      void _coalesce();
+      void _coalesceDone(int64_t end);
+#endif
+      // early run which is not coalesced
+      void _requestEarlyRun() {
+        _lastEnd = 0;
+        _reschedule();
       }
+
+      // find the planned start of a run starting at now with a fixed rate, and count the missed deadlines
+      void _plan(int64_t now) {
+        if (!_lastEnd || !_intervalUs) {
+          // first run or early run: the periods start from now
+          _planned = now;
+          return;
+        }
+        _planned = _lastEnd + _intervalUs;
+        if (now < _planned) {
+          // forced run: keep the next planned start
+          _planned = _lastEnd;
+          return;
+        }
+        const int64_t late = (now - _planned) / _intervalUs;
+        if (!late)
+          return;
+        if (_scheduling == Scheduling::FIXED_RATE_SKIP) {
+          _planned += late * _intervalUs;
+          _missed.fetch_add(late, std::memory_order_relaxed);
+        } else {
+          _missed.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+
+#ifndef MYCILA_TASK_MANAGER_NO_OFFLOADING
+      // hand over the run to the FreeRTOS task of the task: the task manager calls _done() once it is finished
+      void _offload(int64_t now);
+      void _stopOffload();
+      static void _asyncOffload(void* params);
+#endif
+
+      // check if the interval has been reached
+      bool _due(int64_t now) const { return _lastEnd == 0 || now - _lastEnd >= _intervalUs; }
+
+      // reposition the task in the deadline scheduler of its task manager, if any
+      void _reschedule();
+      // wake up the async task manager of this task, if it is waiting for the next due task
+      void _wakeUp();
+
+      friend class TaskManager;
+      friend class TaskManagerGroup;
   };
 
   class TaskManager {
     public:
+      enum class Scheduler {
+        // all tasks are checked in order on each loop() pass
+        LINEAR,
+        // tasks are kept ordered by their next due time and only the due ones are checked on each loop() pass
+        DEADLINE
+      };
+
       explicit TaskManager(const char* name) : _name(name) {}
 
-      ~TaskManager() { _tasks.clear(); }
+      virtual ~TaskManager();
 
       const char* name() const { return _name; }
 
@@ -230,94 +759,332 @@ namespace Mycila {
         return newTask(name, Task::Type::FOREVER, fn);
       }
 
+      // create a new task owned by the task manager: it is deleted when removed
+      // There must be memory left for it: use tryNewTask() when a StaticTaskManager can be full.
       Task& newTask(const char* name, Task::Type type, Task::Function fn) {
-        auto task = std::make_shared<Task>(name, type, fn);
-        _tasks.push_back(task);
+        Task* task = tryNewTask(name, type, fn);
+        assert(task);
         return *task;
       }
 
+      Task* tryNewTask(const char* name, Task::Function fn) {
+        return tryNewTask(name, Task::Type::FOREVER, fn);
+      }
+
+      // same as newTask(), but returns nullptr if there is no memory left, or when a StaticTaskManager is full
+      Task* tryNewTask(const char* name, Task::Type type, Task::Function fn) {
+        void* memory = _allocateTask();
+        if (!memory)
+          return nullptr;
+        Task* task = new (memory) Task(name, type, fn);
+        task->_owned = true;
+        addTask(*task);
+        return task;
+      }
+
+      // Add a task owned by the caller. A task can only be in one task manager.
+      // When the task manager runs async, a task added from another FreeRTOS task, or from a task running on a worker of a pool,
+      // joins it at the start of the next loop() pass.
       void addTask(Task& task) { // NOLINT
-        _tasks.push_back(std::shared_ptr<Task>(&task, doNotDelete));
+        assert(!task._manager);
+        if (!_looping()) {
+          _queueAdd(task);
+          return;
+        }
+        _tasks.insert(&task);
+        _attach(task);
+        _wakeUp();
       }
 
+      // Remove a task, and delete it if it was created with newTask().
+      // When the task manager runs async, a task removed from another FreeRTOS task leaves it at the start of the next loop() pass
+      // where it is not running or triggered: the caller waits for it, without stopping the task manager.
       void removeTask(Task& task) { // NOLINT
-        _tasks.remove_if([&task](const std::shared_ptr<Task>& t) { return t.get() == &task; });
+        if (!_looping()) {
+          _queueRemove(task);
+          return;
+        }
+        if (!task._manager && task._moveTo.load(std::memory_order_acquire) == this)
+          _loopMoves();
+        if (task._manager != this)
+          return;
+        if (task._triggered.load(std::memory_order_acquire))
+          _untrigger(task);
+        _detach(task);
+        _tasks.remove(&task);
+        if (task._owned) {
+          task.~Task();
+          _releaseTask(&task);
+        }
       }
 
       // number of tasks
       size_t tasks() const { return _tasks.size(); }
       bool empty() const { return _tasks.empty(); }
 
+      // get the smallest remaining time in milliseconds before one of the scheduled tasks should run
+      // returns UINT32_MAX if no task is scheduled
+      uint32_t remainingTme() const {
+        int64_t remaining = remainingMicros();
+        return remaining == INT64_MAX ? UINT32_MAX : remaining / 1000;
+      }
+      // same as remainingTme() but in microseconds, returns INT64_MAX if no task is scheduled
+      int64_t remainingMicros() const;
+
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+      // Keep a schedule of the tasks sorted by next due time, where the loop() passes update the tasks which changed,
+      // so that the queries below do not go through the tasks or evaluate their predicates. It can be read from any FreeRTOS task.
+      // The tasks which are paused, disabled or running are not in it, and the predicates are the results of their last check.
+      // The entries are allocated for the tasks of the task manager, and stored inline in a StaticTaskManager.
+      void enableScheduleSnapshot();
+      void disableScheduleSnapshot() { _scheduleEnabled = false; }
+      bool scheduleSnapshot() const { return _scheduleEnabled; }
+      // next task due, or nullptr, and its due time in microseconds from esp_timer_get_time() if dueAt is set
+      Task* nextDue(int64_t* dueAt = nullptr) const;
+      // due time of the next task in microseconds from esp_timer_get_time(), or INT64_MAX if none
+      int64_t earliestDeadline() const {
+        int64_t dueAt = INT64_MAX;
+        nextDue(&dueAt);
+        return dueAt;
+      }
+      // number of tasks due in the next windowMillis (the late ones included), the first max of them being copied to tasks in due order
+      size_t dueWithin(uint32_t windowMillis, Task** tasks = nullptr, size_t max = 0) const;
+#endif
+
+      // change the way due tasks are found on each loop() pass.
+      // LINEAR is the default and is best for a few tasks.
+      // DEADLINE keeps the tasks ordered by their next due time so that a pass only looks at the due tasks.
+      void setScheduler(Scheduler scheduler);
+      Scheduler scheduler() const { return _scheduler; }
+
+      // Limit the time spent running the due tasks in one loop() pass, in microseconds: 0 means no limit (default).
+      // Once the budget is spent, the due tasks left, which have a lower priority, are deferred to the next pass.
+      // At least one due task runs per pass. Triggered tasks are not deferred.
+      void setLoopBudget(uint32_t budgetMicros) { _budget = budgetMicros; }
+      uint32_t loopBudget() const { return _budget; }
+
+      // Adapt the interval of the tasks with an adaptive interval every periodMillis, from the utilization of the task manager:
+      // the share of time spent in the loop() passes running tasks, measured by enableProfiling() or else by enableOverheadProfiling().
+      // - above highPercent, the intervals of the adaptive tasks costing the most, as per their statistics, are doubled until the excess is shed
+      // - below lowPercent, the intervals are shortened by a quarter as long as the expected utilization stays below highPercent
+      // setAdaptiveScheduling(0) stops adapting and keeps the current intervals.
+#ifndef MYCILA_TASK_MANAGER_NO_ADAPTIVE
+      void setAdaptiveScheduling(uint32_t periodMillis, uint8_t lowPercent = 50, uint8_t highPercent = 80);
+      // utilization measured by the last adaptation, in percent
+      float utilization() const { return _utilization; }
+#else
+      float utilization() const { return 0; }
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_TIMEOUTS
+      // Check the tasks with a timeout every checkMillis from a periodic esp_timer, without any cost in loop():
+      // a run over the timeout of its task is logged once with the name of the task and counted in Task::timeouts().
+      // Returns false if the timer could not be started.
+      bool enableTimeoutMonitor(uint32_t checkMillis = 100);
+      void disableTimeoutMonitor();
+      // check the tasks once, for example from an existing timer: returns the number of runs which went over their timeout
+      size_t checkTimeouts();
+#endif
+
+      // The async tasks started with wdt = true feed the Task Watchdog Timer at most every intervalMillis instead of on each loop() pass.
+      // Keep it well below the WDT timeout. Default is 100 ms.
+      void setWDTFeedInterval(uint32_t intervalMillis) { _wdtFeedUs = static_cast<int64_t>(intervalMillis) * 1000; }
+
       // Must be called from main loop and will loop over all registered tasks.
       // When using async mode, do not call loop: the async task will call it.
       // Returns the number of executed tasks
       size_t loop() {
-        size_t executed = 0;
-        uint32_t now = millis();
-        for (auto& task : _tasks) {
-          if (task->tryRun()) {
-            executed++;
-            yield();
+        if (_outgoingTasks.load(std::memory_order_relaxed) || _incomingTasks.load(std::memory_order_relaxed))
+          _loopMoves();
+        if (_reprioritized.load(std::memory_order_relaxed))
+          _loopPriorities();
+        int64_t now = esp_timer_get_time();
+        if (_hasCompleted())
+          _loopCompleted();
+        size_t executed = _triggeredTasks.load(std::memory_order_relaxed) ? _loopTriggered() : 0;
+        if (_scheduler == Scheduler::DEADLINE) {
+          executed += _loopDeadline(now);
+        } else {
+          // the tasks are ordered by priority
+          for (Task* task : _tasks) {
+            if (task->tryRun()) {
+              executed++;
+              yield();
+              if (_overBudget(now))
+                break;
+            }
           }
         }
-        if (_stats && executed) {
-          _stats->record(millis() - now);
+        // run the tasks released by the tasks run in this pass, or triggered meanwhile
+        if (_triggeredTasks.load(std::memory_order_relaxed))
+          executed += _loopTriggered();
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+        if (executed) {
+          BinStatistics* stats = _stats.load(std::memory_order_relaxed);
+          WindowedBinStatistics* windowedStats = _windowedStats.load(std::memory_order_relaxed);
+          if (stats || windowedStats) {
+            const int64_t end = esp_timer_get_time();
+            if (stats)
+              stats->recordMicros(end - now);
+            if (windowedStats)
+              windowedStats->recordMicros(end - now, end / 1000);
+          }
         }
+        if (_overheadProfiling)
+          _profilePass(now, executed);
+#endif
+#ifndef MYCILA_TASK_MANAGER_NO_ADAPTIVE
+        if (_adaptivePeriodUs && now - _adaptedAt >= _adaptivePeriodUs)
+          _adapt();
+#endif
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+        if (_scheduleEnabled && _scheduleDirty.load(std::memory_order_relaxed))
+          _refreshSchedule();
+#endif
         return executed;
       }
 
       // call pause() on all tasks
       void pause() {
-        for (auto& task : _tasks)
+        for (Task* task : _tasks)
           task->pause();
       }
 
       // call resume() on all tasks
       void resume(uint32_t delayMillis = 0) {
-        for (auto& task : _tasks)
+        for (Task* task : _tasks)
           task->resume(delayMillis);
       }
 
       void setEnabled(bool enabled) {
-        for (auto& task : _tasks)
+        for (Task* task : _tasks)
           task->setEnabled(enabled);
       }
 
       // enable profiling for all tasks, plus the task manager itself
       // unitDivider is the divider to se for the unit: 1 for milliseconds, 1000 for seconds, etc
-      void enableProfiling(uint8_t taskManagerBinCount, uint8_t taskBinCount, uint32_t unitDividerMillis = 1) {
-        if (!_stats)
-          _stats = new BinStatistics(taskManagerBinCount, unitDividerMillis);
-        for (auto& task : _tasks)
-          task->enableProfiling(taskBinCount, unitDividerMillis);
+      // unit is the time unit recorded before applying the divider: use MICROSECONDS for tasks running under a millisecond
+      void enableProfiling(uint8_t taskManagerBinCount, uint8_t taskBinCount, uint32_t unitDivider = 1, BinStatistics::Unit unit = BinStatistics::Unit::MILLISECONDS) {
+        enableProfiling(taskManagerBinCount, unitDivider, unit);
+        for (Task* task : _tasks)
+          task->enableProfiling(taskBinCount, unitDivider, unit);
       }
 
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
       // enable profiling for the task manager only
-      void enableProfiling(uint8_t taskManagerBinCount = 12, uint32_t unitDividerMillis = 1) {
-        if (!_stats)
-          _stats = new BinStatistics(taskManagerBinCount, unitDividerMillis);
-      }
+      void enableProfiling(uint8_t taskManagerBinCount = 12, uint32_t unitDivider = 1, BinStatistics::Unit unit = BinStatistics::Unit::MILLISECONDS);
 
       // disable profiling for all tasks, plus the task manager itself
-      void disableProfiling() {
-        if (_stats) {
-          delete _stats;
-          _stats = nullptr;
-        }
-        for (auto& task : _tasks)
-          task->disableProfiling();
+      // the statistics are kept until profiling is enabled again, for the readers on other cores
+      void disableProfiling();
+
+      // statistics of the loop() passes which executed at least one task, or nullptr if not profiled
+      const BinStatistics* statistics() const { return _stats.load(std::memory_order_acquire); }
+
+      // enable profiling in a ring of time windows for all tasks, plus the task manager itself
+      // windowCount windows of windowMillis each are kept: the others parameters are the ones of enableProfiling()
+      void enableWindowedProfiling(uint8_t windowCount, uint32_t windowMillis, uint8_t taskManagerBinCount, uint8_t taskBinCount, uint32_t unitDivider = 1, BinStatistics::Unit unit = BinStatistics::Unit::MILLISECONDS);
+      // disable profiling in time windows for all tasks, plus the task manager itself
+      void disableWindowedProfiling();
+      const WindowedBinStatistics* windowedStatistics() const { return _windowedStats.load(std::memory_order_acquire); }
+#else
+      // profiling is compiled out with MYCILA_TASK_MANAGER_NO_PROFILING: it can be enabled but nothing is recorded
+      void enableProfiling(uint8_t = 12, uint32_t = 1, BinStatistics::Unit = BinStatistics::Unit::MILLISECONDS) {}
+      void disableProfiling() {}
+      const BinStatistics* statistics() const { return nullptr; }
+      void enableWindowedProfiling(uint8_t, uint32_t, uint8_t, uint8_t, uint32_t = 1, BinStatistics::Unit = BinStatistics::Unit::MILLISECONDS) {}
+      void disableWindowedProfiling() {}
+      const WindowedBinStatistics* windowedStatistics() const { return nullptr; }
+#endif
+
+      // record the start latency of all the tasks
+      void enableLatencyProfiling(uint8_t taskBinCount = 10, uint32_t unitDivider = 1, BinStatistics::Unit unit = BinStatistics::Unit::MILLISECONDS) {
+        for (Task* task : _tasks)
+          task->enableLatencyProfiling(taskBinCount, unitDivider, unit);
+      }
+      void disableLatencyProfiling() {
+        for (Task* task : _tasks)
+          task->disableLatencyProfiling();
       }
 
+      // Time spent by the task manager, in microseconds since enableOverheadProfiling().
+      // It is measured in loop(): the workers of asyncStartPool() are not profiled.
+      struct Overhead {
+          // time since enableOverheadProfiling(), or until disableOverheadProfiling()
+          int64_t elapsed = 0;
+          // time spent in loop() to find and start the due tasks: the cost of the scheduling
+          int64_t poll = 0;
+          // time spent in the enabled predicates of the tasks
+          int64_t predicates = 0;
+          // time spent in the task functions run by loop()
+          int64_t tasks = 0;
+          // time spent outside of loop(): sleeping between passes, or in the rest of the program
+          int64_t idle = 0;
+          uint32_t passes = 0;
+          // passes which did not run any task
+          uint32_t wastedPasses = 0;
+      };
+
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+      // start measuring the overhead of the task manager and the time spent in each task, from 0
+      void enableOverheadProfiling();
+      // stop measuring: the values are kept
+      void disableOverheadProfiling();
+      bool overheadProfiling() const { return _overheadProfiling; }
+      Overhead overhead() const;
+#else
+      void enableOverheadProfiling() {}
+      void disableOverheadProfiling() {}
+      bool overheadProfiling() const { return false; }
+      Overhead overhead() const { return Overhead(); }
+#endif
+
       // log all tasks
       void log();
+      // same as log() but the lines are printed to out, without allocating
+      void log(Print& out); // NOLINT
+
+      // json output of the task manager and its tasks, written to out as it goes: no JSON document or allocation needed
+      void toJson(Print& out) const; // NOLINT
+
+#ifndef MYCILA_TASK_MANAGER_NO_BINARY
+      // Compact binary output of the task manager and its tasks, for telemetry.
+      // With delta, the names are not sent and the counters and statistics are the differences since the previous export.
+      // An export is sent in full instead if a task was added, removed or moved by a priority change since the previous export.
+      // Integers are unsigned LEB128 varints, a name is its length followed by its characters (no terminating null) and flags are one byte.
+      //   task manager: version (2), flags (bit 0: delta), bin counter size in bytes (2, or 4 with MYCILA_TASK_MANAGER_32BIT_BINS), [name], statistics, task count, tasks
+      //   task: flags (bit 0: ONCE, 1: paused, 2: enabled, 3: running, 4: fixed rate, 5: coalescing, 6: offloaded), [name],
+      //         priority, interval (ms), missed deadlines, overruns, coalesced, statistics, latency statistics
+      //   statistics: flags (0: none, otherwise bit 0: present, 1: delta, 2: microseconds), [unit divider, bin count, count, min, max, sum, bins]
+      // The statistics of a task can be sent in full in a delta export when they were cleared or replaced meanwhile: min and max are never deltas.
+      // A bin stops at the maximum of its counter size.
+      void toBinary(Print& out, bool delta = false); // NOLINT
+#endif
 
       // json output of the task manager
 #ifdef MYCILA_JSON_SUPPORT
       void toJson(const JsonObject& root) const {
         root["name"] = _name;
-        if (_stats && _stats->bins() && _stats->count())
-          _stats->toJson(root["stats"].to<JsonObject>());
-        for (auto& task : _tasks)
+  #ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+        const BinStatistics* stats = statistics();
+        if (stats && stats->bins() && stats->count())
+          stats->toJson(root["stats"].to<JsonObject>());
+        const WindowedBinStatistics* windowedStats = windowedStatistics();
+        if (windowedStats)
+          windowedStats->toJson(root["windows"].to<JsonArray>());
+        if (_overheadStart) {
+          const Overhead o = overhead();
+          JsonObject json = root["overhead"].to<JsonObject>();
+          json["elapsed"] = o.elapsed;
+          json["poll"] = o.poll;
+          json["predicates"] = o.predicates;
+          json["tasks"] = o.tasks;
+          json["idle"] = o.idle;
+          json["passes"] = o.passes;
+          json["wasted"] = o.wastedPasses;
+        }
+  #endif
+        for (Task* task : _tasks)
           task->toJson(root["tasks"].add<JsonObject>());
       }
 #endif
@@ -333,42 +1100,658 @@ namespace Mycila {
                       uint32_t delay = 10,
                       bool wdt = false);
 
-      // kill the async task
-      void asyncStop();
+      // Start the task manager with a pool of worker tasks sharing the tasks of this task manager.
+      // Due tasks are spread over the workers, which steal work from each other when idle.
+      // A task never runs on two workers at the same time.
+      // - If pinToCores is true, the workers are pinned to the cores in turn, otherwise they can run on any core
+      // - If priority is not set (-1), then the workers will run with the same priority as the caller
+      // - delay and wdt are the same as for asyncStart()
+      // Each worker queues as many tasks as the task manager has when the pool starts (16 at least):
+      // a due task which finds all the queues full waits for the next pass.
+      bool asyncStartPool(uint8_t workers,
+                          uint32_t stackSize = 4096,
+                          BaseType_t priority = -1,
+                          bool pinToCores = true,
+                          uint32_t delay = 10,
+                          bool wdt = false);
+      // number of workers started with asyncStartPool()
+      uint8_t workers() const { return _workerCount; }
+
+      // Stop the async task, or the workers of the pool, once the task running is done.
+      // The ONCE tasks still due or triggered, and the offloaded runs in flight, are given drainMillis to finish.
+      // When called from a task of the task manager itself, the stop happens at the end of the loop() pass, otherwise the caller waits for it.
+      void asyncStop(uint32_t drainMillis = 0);
+
+      // Park the async task, or the workers of the pool, like asyncStop() but without deleting them:
+      // asyncResume() restarts them straight away, without creating the FreeRTOS tasks again.
+      // The parked tasks are removed from the WDT meanwhile. Returns false if the task manager is not running async or is already suspended.
+      bool asyncSuspend(uint32_t drainMillis = 0);
+      bool asyncResume();
+      bool asyncSuspended() const { return _asyncRequest.load(std::memory_order_relaxed) == AsyncRequest::SUSPEND; }
+
+      // When no task is executed, make the async task wait until the next task is due instead of waiting for the fixed delay of asyncStart().
+      // The async task is woken up as soon as a task is added, resumed or requested to run early.
+      // The wait is bounded by maxSleepMillis to catch tasks enabled by a predicate: keep it lower than the WDT timeout.
+      void setSleepUntilDue(bool enable, uint32_t maxSleepMillis = 1000) {
+        _maxSleep = maxSleepMillis;
+        _sleepUntilDue = enable;
+        _wakeUp();
+      }
+      bool sleepUntilDue() const { return _sleepUntilDue; }
 
       // Initialize the global Task Watchdog Timer (TWDT)
       // Ref: https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/system/wdts.html
       // Returns true if the WDT was configured or reconfigured successfully
       static bool configureWDT(uint32_t timeoutSeconds = CONFIG_ESP_TASK_WDT_TIMEOUT_S, bool panic = true);
 
+    protected:
+      // memory of the tasks created with newTask()
+      virtual void* _allocateTask() { return ::operator new(sizeof(Task), std::nothrow); }
+      virtual void _releaseTask(void* memory) { ::operator delete(memory); }
+      // remove all the tasks: to be called by the destructor of the subclasses providing the task memory
+      void _removeAll() {
+        for (Task* task : _tasks)
+          removeTask(*task);
+      }
+      // make room in the scheduler structures for this number of tasks
+      void _reserve(size_t tasks) {
+        _heap.reserve(tasks);
+        _due.reserve(tasks);
+      }
+
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+      // schedule snapshot: entries sorted by due time, with a sequence counter for the readers like BinStatistics
+      struct ScheduleEntry {
+          int64_t dueAt;
+          Task* task;
+      };
+      // entries provided by a subclass, which are never freed
+      void _scheduleStorage(ScheduleEntry* entries, size_t capacity) {
+        _schedule.store(entries, std::memory_order_relaxed);
+        _scheduleInline = entries;
+        _scheduleCapacity = capacity;
+      }
+#endif
+
     private:
+      // intrusive list of the tasks: adding and removing does not allocate and the current task can be removed while iterating
+      class TaskList {
+        public:
+          class Iterator {
+            public:
+              explicit Iterator(Task* task) : _task(task), _next(task ? task->_next : nullptr) {}
+              Task* operator*() const { return _task; }
+              Iterator& operator++() {
+                _task = _next;
+                _next = _task ? _task->_next : nullptr;
+                return *this;
+              }
+              bool operator!=(const Iterator& other) const { return _task != other._task; }
+
+            private:
+              Task* _task;
+              Task* _next;
+          };
+
+          Iterator begin() const { return Iterator(_first); }
+          Iterator end() const { return Iterator(nullptr); }
+          size_t size() const { return _size; }
+          bool empty() const { return !_size; }
+
+          // the changes are locked against the readers from other FreeRTOS tasks, like the timeout monitor
+          void lock() const { portENTER_CRITICAL(&_lock); }
+          void unlock() const { portEXIT_CRITICAL(&_lock); }
+
+          // insert the task after the last task with the same or a higher priority
+          void insert(Task* task) {
+            lock();
+            Task* prev = _last;
+            while (prev && prev->_priority < task->_priority)
+              prev = prev->_prev;
+            task->_prev = prev;
+            task->_next = prev ? prev->_next : _first;
+            if (task->_next)
+              task->_next->_prev = task;
+            else
+              _last = task;
+            if (prev)
+              prev->_next = task;
+            else
+              _first = task;
+            _size++;
+            unlock();
+          }
+
+          void remove(Task* task) {
+            lock();
+            if (task->_prev)
+              task->_prev->_next = task->_next;
+            else
+              _first = task->_next;
+            if (task->_next)
+              task->_next->_prev = task->_prev;
+            else
+              _last = task->_prev;
+            task->_prev = nullptr;
+            task->_next = nullptr;
+            _size--;
+            unlock();
+          }
+
+        private:
+          mutable portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+          Task* _first = nullptr;
+          Task* _last = nullptr;
+          size_t _size = 0;
+      };
+
       const char* _name;
-      std::list<std::shared_ptr<Task>> _tasks;
-      Mycila::BinStatistics* _stats = nullptr;
+      TaskList _tasks;
+#ifndef MYCILA_TASK_MANAGER_NO_BINARY
+      // changed by each add, remove and priority reorder: a delta export needs the same task positions as the last export
+      uint32_t _generation = 0;
+      uint32_t _exportedGeneration = UINT32_MAX;
+#endif
+      uint32_t _budget = 0;
+      bool _overBudget(int64_t start) const { return _budget && esp_timer_get_time() - start >= _budget; }
+
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+      bool _scheduleEnabled = false;
+      std::atomic<bool> _scheduleDirty{false};
+      std::atomic<uint32_t> _scheduleSeq{0};
+      std::atomic<ScheduleEntry*> _schedule{nullptr};
+      std::atomic<size_t> _scheduleSize{0};
+      size_t _scheduleCapacity = 0;
+      ScheduleEntry* _scheduleInline = nullptr;
+      // entries replaced by a bigger array, freed once no query is reading the entries
+      ScheduleEntry* _retiredSchedule = nullptr;
+      mutable std::atomic<uint32_t> _scheduleReaders{0};
+      void _scheduleFree(ScheduleEntry* entries) {
+        if (entries != _scheduleInline)
+          delete[] entries;
+      }
+      bool _growSchedule(size_t capacity);
+      // move the entry of a task to its due time, or take it out
+      void _schedulePlace(Task& task, int64_t now);
+      void _scheduleErase(Task& task);
+      void _refreshSchedule();
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_ADAPTIVE
+      // adaptive scheduling
+      int64_t _adaptivePeriodUs = 0;
+      int64_t _adaptedAt = 0;
+      uint64_t _adaptiveBusy = 0;
+      uint32_t _adaptiveRound = 0;
+      uint8_t _adaptiveLow = 0;
+      uint8_t _adaptiveHigh = 0;
+      float _utilization = 0;
+      void _adapt();
+#endif
+      // time spent running tasks, or UINT64_MAX if not measured
+      uint64_t _measuredBusy() const;
       bool _wdt = false;
+      int64_t _wdtFeedUs = 100000;
+      // feed the WDT if it was not fed for the feed interval
+      void _feedWDT(int64_t& fedAt) {
+        const int64_t now = esp_timer_get_time();
+        if (now - fedAt >= _wdtFeedUs) {
+          esp_task_wdt_reset();
+          fedAt = now;
+        }
+      }
+#ifndef MYCILA_TASK_MANAGER_NO_TIMEOUTS
+      esp_timer_handle_t _timeoutMonitor = nullptr;
+#endif
+
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+      std::atomic<BinStatistics*> _stats{nullptr};
+      BinStatistics* _retiredStats = nullptr;
+      std::atomic<WindowedBinStatistics*> _windowedStats{nullptr};
+      WindowedBinStatistics* _retiredWindowedStats = nullptr;
+
+      // overhead profiling: the time in the tasks and predicates is added up by the tasks
+      bool _overheadProfiling = false;
+      int64_t _overheadStart = 0;
+      int64_t _overheadEnd = 0;
+      MicrosCounter _loopUs;
+      MicrosCounter _taskUs;
+      std::atomic<uint32_t> _passes{0};
+      std::atomic<uint32_t> _wastedPasses{0};
+      void _profilePass(int64_t start, size_t executed) {
+        _loopUs.add(esp_timer_get_time() - start);
+        _passes.fetch_add(1, std::memory_order_relaxed);
+        if (!executed)
+          _wastedPasses.fetch_add(1, std::memory_order_relaxed);
+      }
+#endif
+
+      // lock-free stack of the tasks triggered from other FreeRTOS tasks or interrupts
+      std::atomic<Task*> _triggeredTasks{nullptr};
+      void _pushTriggered(Task& task) {
+        Task* head = _triggeredTasks.load(std::memory_order_relaxed);
+        do {
+          task._nextTriggered = head;
+        } while (!_triggeredTasks.compare_exchange_weak(head, &task, std::memory_order_release, std::memory_order_relaxed));
+      }
+      size_t _loopTriggered();
+      // triggered tasks taken by _loopTriggered() and not run yet
+      Task* _triggeredRun = nullptr;
+      // unlink a task removed while it is triggered
+      void _untrigger(Task& task);
+
+#ifndef MYCILA_TASK_MANAGER_NO_OFFLOADING
+      // lock-free stack of the offloaded tasks which finished their run
+      std::atomic<Task*> _completedTasks{nullptr};
+      void _pushCompleted(Task& task) {
+        Task* head = _completedTasks.load(std::memory_order_relaxed);
+        do {
+          task._nextCompleted = head;
+        } while (!_completedTasks.compare_exchange_weak(head, &task, std::memory_order_release, std::memory_order_relaxed));
+      }
+      bool _hasCompleted() const { return _completedTasks.load(std::memory_order_relaxed); }
+      void _loopCompleted();
+      // wait for the offloaded run of this task, if any, to be finished and collected by the task manager's own task
+      void _waitCompleted(Task& task);
+#else
+      bool _hasCompleted() const { return false; }
+      void _loopCompleted() {}
+      void _waitCompleted(Task&) {}
+#endif
 
-      static void doNotDelete(Mycila::Task* t) {}
+      // lock-free stacks of the tasks moving to another task manager, and of the ones moving to this one
+      std::atomic<Task*> _outgoingTasks{nullptr};
+      std::atomic<Task*> _incomingTasks{nullptr};
+      static void _pushMoving(std::atomic<Task*>& stack, Task& task) {
+        Task* head = stack.load(std::memory_order_relaxed);
+        do {
+          task._nextMoving = head;
+        } while (!stack.compare_exchange_weak(head, &task, std::memory_order_release, std::memory_order_relaxed));
+      }
+      void _loopMoves();
+      // tasks whose priority changed, moved at the start of a loop() pass: never while a pass goes through the list
+      std::atomic<bool> _reprioritized{false};
+      void _loopPriorities();
+
+      // changes of the task list from outside of the async task manager: applied by _loopMoves()
+      bool _remote() const {
+        if (!_taskManagerHandle)
+          return false;
+        const TaskHandle_t current = xTaskGetCurrentTaskHandle();
+        for (uint8_t i = 0; i < _workerCount; i++)
+          if (_workers[i].handle == current)
+            return false;
+        return current != _taskManagerHandle;
+      }
+      // the task list, the heap and the due list are only changed by the task running loop(): in a pool, the worker dispatching
+      bool _looping() const {
+        if (!_taskManagerHandle)
+          return true;
+        const TaskHandle_t current = xTaskGetCurrentTaskHandle();
+        return _workers ? current == _dispatcher : current == _taskManagerHandle;
+      }
+      void _queueAdd(Task& task);
+      void _queueRemove(Task& task);
+      void _notify() {
+        if (_taskManagerHandle)
+          xTaskNotifyGive(_taskManagerHandle);
+      }
+
+      void _attach(Task& task) {
+        task._manager = this;
+#ifndef MYCILA_TASK_MANAGER_NO_BINARY
+        _generation++;
+#endif
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+        task._scheduleChanged.store(true, std::memory_order_relaxed);
+        _scheduleDirty.store(true, std::memory_order_relaxed);
+#endif
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+        task._overheadProfiling = _overheadProfiling;
+#endif
+        if (_scheduler == Scheduler::DEADLINE) {
+          // the heap never holds more than all the tasks: avoid growing it while locked
+          // (_due follows at the next pass: it can be iterated right now)
+          if (_heap.capacity() < _tasks.size())
+            _heap.reserve(_tasks.size() * 2);
+          _reschedule(task);
+        }
+      }
+      void _detach(Task& task) {
+        if (task._manager == this) {
+#ifndef MYCILA_TASK_MANAGER_NO_BINARY
+          _generation++;
+#endif
+          _waitCompleted(task);
+          _unschedule(task);
+          // popped by the pass in progress: it must not run nor go back in the heap
+          for (Task*& due : _due)
+            if (due == &task)
+              due = nullptr;
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+          task._overheadProfiling = false;
+#endif
+          task._manager = nullptr;
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+          if (task._scheduleIndex >= 0)
+            _scheduleErase(task);
+#endif
+        }
+      }
+
+      // deadline scheduler: binary min-heap of the tasks ordered by next due time
+      Scheduler _scheduler = Scheduler::LINEAR;
+      std::vector<Task*> _heap;
+      // due tasks popped from the heap during a loop() pass, ordered by priority
+      std::vector<Task*> _due;
+      void _popDue(int64_t now);
+      mutable portMUX_TYPE _heapLock = portMUX_INITIALIZER_UNLOCKED;
+      size_t _loopDeadline(int64_t now);
+      void _reschedule(Task& task);
+      void _unschedule(Task& task);
+      void _heapSiftUp(size_t index);
+      void _heapSiftDown(size_t index);
+      void _heapSet(size_t index, Task* task) {
+        _heap[index] = task;
+        task->_heapIndex = index;
+      }
 
       // async
       TaskHandle_t _taskManagerHandle = NULL;
       uint32_t _delay = 0;
+      bool _sleepUntilDue = false;
+      uint32_t _maxSleep = 0;
       static void _asyncTaskManager(void* params) {
         TaskManager* taskManager = reinterpret_cast<TaskManager*>(params);
+        int64_t fedAt = 0;
         while (true) {
           if (taskManager->_wdt)
-            esp_task_wdt_reset();
-          if (!taskManager->loop()) {
-            if (taskManager->_delay)
-              delay(taskManager->_delay);
+            taskManager->_feedWDT(fedAt);
+          const size_t executed = taskManager->loop();
+          if (taskManager->_asyncRequest.load(std::memory_order_acquire) != AsyncRequest::NONE && !taskManager->_park())
+            break;
+          if (!executed) {
+            if (taskManager->_sleepUntilDue)
+              taskManager->_sleep();
+            else if (taskManager->_delay)
+              // delay that can be interrupted by triggered tasks
+              ulTaskNotifyTake(pdTRUE, (taskManager->_delay + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
             else
               yield();
           }
         }
         vTaskDelete(NULL);
       }
+      void _sleep();
+
+      // cooperative stop and suspend of the async tasks, which park at the end of a loop() pass once drained
+      enum class AsyncRequest : uint8_t {
+        NONE,
+        SUSPEND,
+        STOP
+      };
+      std::atomic<AsyncRequest> _asyncRequest{AsyncRequest::NONE};
+      std::atomic<uint8_t> _parked{0};
+      // async tasks which reached the end of a stop asked by one of them: the last one deletes the other ones
+      std::atomic<uint8_t> _stopped{0};
+      // the drain deadline is written with the request, under the lock, by the caller which sets it
+      portMUX_TYPE _asyncLock = portMUX_INITIALIZER_UNLOCKED;
+      int64_t _drainUntil = 0;
+      bool _asyncRequestSet(AsyncRequest expected, AsyncRequest request, uint32_t drainMillis);
+      // number of async tasks created
+      uint8_t _asyncTasks() const {
+        if (!_workers)
+          return _taskManagerHandle ? 1 : 0;
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < _workerCount; i++)
+          if (_workers[i].handle)
+            count++;
+        return count;
+      }
+      bool _drained() const;
+      bool _park();
+      // apply the tasks added and removed while parked, or while waiting in a task of a worker,
+      // so that the callers waiting for them are not blocked
+      void _applyMoves();
+      void _asyncClear();
+      void _notifyAll() {
+        if (_workers) {
+          for (uint8_t i = 0; i < _workerCount; i++)
+            if (_workers[i].handle)
+              xTaskNotifyGive(_workers[i].handle);
+        } else {
+          _notify();
+        }
+      }
+
+      // worker pool
+      struct Worker {
+          TaskManager* manager = nullptr;
+          uint8_t index = 0;
+          TaskHandle_t handle = NULL;
+          portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+          // ring buffer of the queued tasks, allocated when the pool starts: nothing is allocated under the lock
+          Task** queue = nullptr;
+          uint16_t capacity = 0;
+          uint16_t head = 0;
+          uint16_t count = 0;
+          ~Worker() { delete[] queue; }
+      };
+      Worker* _workers = nullptr;
+      uint8_t _workerCount = 0;
+      uint8_t _nextWorker = 0;
+      std::atomic<bool> _dispatching{false};
+      TaskHandle_t _dispatcher = NULL;
+      static void _asyncWorker(void* params);
+      size_t _workerLoop(Worker& worker);
+      void _dispatch(Task& task);
+      Task* _takeWork(Worker& worker);
+      // take a task out of the queue of its worker: returns false if it is not queued anymore
+      bool _unqueue(Task& task);
+      void _wakeUp() {
+        if (_sleepUntilDue && _taskManagerHandle && xTaskGetCurrentTaskHandle() != _taskManagerHandle)
+          xTaskNotifyGive(_taskManagerHandle);
+      }
 
     private:
       friend class Task;
+      friend class TaskManagerGroup;
   };
 
+  // A task manager where adding and removing tasks does not allocate after setup: the tasks created with newTask() are stored inline,
+  // and the scheduler structures are sized for Capacity tasks. The tasks themselves can still allocate: the std::function captures
+  // (unless MYCILA_TASK_MANAGER_INLINE_FUNCTIONS is set), the successors added with then(), and the statistics when profiling is enabled.
+  template <size_t Capacity>
+  class StaticTaskManager : public TaskManager {
+    public:
+      explicit StaticTaskManager(const char* name) : TaskManager(name) {
+        for (size_t i = 0; i < Capacity; i++)
+          _free[i] = Capacity - 1 - i;
+        _reserve(Capacity);
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+        _scheduleStorage(_scheduleEntries, Capacity);
+#endif
+      }
+
+      ~StaticTaskManager() { _removeAll(); }
+
+      // maximum number of tasks created with newTask()
+      size_t capacity() const { return Capacity; }
+
+    protected:
+      // tasks can be created and removed from any FreeRTOS task
+      void* _allocateTask() override {
+        void* memory = nullptr;
+        portENTER_CRITICAL(&_freeLock);
+        if (_freeCount)
+          memory = _storage[_free[--_freeCount]];
+        portEXIT_CRITICAL(&_freeLock);
+        return memory;
+      }
+      void _releaseTask(void* memory) override {
+        portENTER_CRITICAL(&_freeLock);
+        _free[_freeCount++] = (static_cast<uint8_t*>(memory) - _storage[0]) / sizeof(Task);
+        portEXIT_CRITICAL(&_freeLock);
+      }
+
+    private:
+      portMUX_TYPE _freeLock = portMUX_INITIALIZER_UNLOCKED;
+      alignas(Task) uint8_t _storage[Capacity][sizeof(Task)];
+      size_t _free[Capacity];
+      size_t _freeCount = Capacity;
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+      ScheduleEntry _scheduleEntries[Capacity];
+#endif
+  };
+
+  // A group of task managers, usually one per core, sharing the load of the tasks added to the group.
+  // rebalance() moves a task from the busiest task manager to the least busy one, based on the time spent running since the previous call.
+  // The time of a task is taken from busyMicros() with its overhead profiling, or from its statistics:
+  // the tasks which are not profiled count for nothing. The time of a task manager is taken from its overhead profiling,
+  // or from its statistics in microseconds, otherwise it is the time of the tasks of the group it runs.
+  // Statistics in milliseconds truncate each run, so that the sub-millisecond runs count for nothing.
+  // The group is not thread-safe: set it up and call rebalance() from the same FreeRTOS task, or use setAutoRebalance().
+  class TaskManagerGroup {
+    public:
+      explicit TaskManagerGroup(const char* name) : _name(name), _balancer(name, [this](void*) { rebalance(); }) {}
+
+      const char* name() const { return _name; }
+
+      // add a task manager to the group: it must live as long as the group
+      void addTaskManager(TaskManager& taskManager); // NOLINT
+      size_t taskManagers() const { return _managers.size(); }
+
+      // Add a task to the group: the task is moved to the task manager of the group with the fewest tasks of the group,
+      // unless it is already in one of them. Returns false if the task cannot move (see Task::moveTo()).
+      bool addTask(Task& task); // NOLINT
+      // the task is not moved by the group anymore and stays where it is
+      void removeTask(Task& task); // NOLINT
+      size_t tasks() const { return _members.size(); }
+
+      // Minimum load difference between the busiest and the least busy task managers to move a task,
+      // in percent of the load of the busiest one. Default is 20.
+      void setThreshold(uint8_t percent) { _threshold = percent; }
+      uint8_t threshold() const { return _threshold; }
+
+      // Measure the load of the task managers since the previous call and move at most one task to even it out:
+      // the one bringing the loads closest to each other. Returns the task moved, or nullptr.
+      Task* rebalance();
+      // load of a task manager of the group measured by the last rebalance(), in microseconds, or 0 if it is not in the group
+      uint64_t load(const TaskManager& taskManager) const;
+
+      // Call rebalance() every intervalMillis from a task of the group itself, run by its first task manager, or stop with 0.
+      // The task managers must be added before.
+      void setAutoRebalance(uint32_t intervalMillis);
+
+    private:
+      struct Manager {
+          TaskManager* manager;
+          // total time measured by the previous rebalance(), and the difference with the one before
+          uint64_t busy;
+          uint64_t load;
+          // time of the tasks of the group it runs, since the previous rebalance()
+          uint64_t tasksLoad;
+          size_t tasks;
+      };
+      struct Member {
+          Task* task;
+          TaskManager* manager;
+          uint64_t busy;
+          uint64_t load;
+      };
+
+      const char* _name;
+      uint8_t _threshold = 20;
+      std::vector<Manager> _managers;
+      std::vector<Member> _members;
+      Task _balancer;
+
+      Manager* _find(const TaskManager* taskManager);
+  };
+
+  inline void Task::_reschedule() {
+    if (!_manager)
+      return;
+    if (_manager->_scheduler == TaskManager::Scheduler::DEADLINE)
+      _manager->_reschedule(*this);
+#ifndef MYCILA_TASK_MANAGER_NO_SNAPSHOT
+    _scheduleChanged.store(true, std::memory_order_relaxed);
+    _manager->_scheduleDirty.store(true, std::memory_order_relaxed);
+#endif
+  }
+
+#ifndef MYCILA_TASK_MANAGER_NO_PROFILING
+  inline void Task::_profile(uint32_t elapsedUs) {
+    _busyUs.add(elapsedUs);
+  #ifndef MYCILA_TASK_MANAGER_NO_OFFLOADING
+    // offloaded runs do not take time from loop()
+    if (_manager && !_offloadHandle.load(std::memory_order_relaxed))
+      _manager->_taskUs.add(elapsedUs);
+  #else
+    if (_manager)
+      _manager->_taskUs.add(elapsedUs);
+  #endif
+  }
+#endif
+
+  inline void Task::_wakeUp() {
+    if (_manager)
+      _manager->_wakeUp();
+  }
 } // namespace Mycila
+
+// Resumable tasks: stackless coroutines for a cooperative state machine in a task function, without a FreeRTOS stack.
+// The task function returns to the task manager when it waits, and continues where it was on its next run.
+// Local variables are not kept between runs: use static variables, captures or the task data.
+// Only use each macro once per line.
+//
+//   Mycila::Task blink("blink", [](void* params) {
+//     MYCILA_TASK_BEGIN(blink);
+//     while (true) {
+//       digitalWrite(LED_BUILTIN, HIGH);
+//       MYCILA_TASK_SLEEP(blink, 500);
+//       digitalWrite(LED_BUILTIN, LOW);
+//       MYCILA_TASK_SLEEP(blink, 500);
+//     }
+//     MYCILA_TASK_END(blink);
+//   });
+#define MYCILA_TASK_BEGIN(task)   \
+  switch ((task).resumePoint()) { \
+    case 0:
+// give back control to the task manager and continue on the next run
+#define MYCILA_TASK_YIELD(task)      \
+  do {                               \
+    (task).setResumePoint(__LINE__); \
+    return;                          \
+    case __LINE__:;                  \
+  } while (0)
+// give back control to the task manager and continue in delayMillis
+#define MYCILA_TASK_SLEEP(task, delayMillis) \
+  do {                                       \
+    (task).setResumePoint(__LINE__);         \
+    (task).sleep(delayMillis);               \
+    return;                                  \
+    case __LINE__:;                          \
+  } while (0)
+// continue once the condition is true: it is checked on each run of the task, at its interval
+#define MYCILA_TASK_WAIT_UNTIL(task, condition) \
+  do {                                          \
+    (task).setResumePoint(__LINE__);            \
+    [[fallthrough]];                            \
+    case __LINE__:                              \
+      if (!(condition))                         \
+        return;                                 \
+  } while (0)
+// pause the task and continue once it is triggered, by trigger() or by the end of a task it follows with then()
+#define MYCILA_TASK_WAIT_TRIGGER(task) \
+  do {                                 \
+    (task).setResumePoint(__LINE__);   \
+    (task).pause();                    \
+    return;                            \
+    case __LINE__:;                    \
+  } while (0)
+// end of the resumable task function: the task is paused and starts again from the beginning when resumed
+#define MYCILA_TASK_END(task) \
+  }                           \
+  (task).setResumePoint(0);   \
+  (task).pause()
@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2023-2025 Mathieu Carbou
+ */
+#pragma once
+
+// Everything the task manager needs from Arduino, ESP-IDF and FreeRTOS.
+//
+// On ESP32 these are the real headers.
+// With MYCILA_TASK_MANAGER_NATIVE (PlatformIO native env), the same API is provided for a single-threaded host build:
+// - esp_timer_get_time() reads Mycila::VirtualClock, which only moves when the program moves it, so runs are reproducible
+// - FreeRTOS task creation always fails: asyncStart() and offloaded tasks are not available, tasks run in loop()
+// - esp_timer timers cannot be created: the timeout monitor is not available
+// - critical sections, notifications, yield() and the watchdog do nothing
+// - logs go to stdout
+#ifndef MYCILA_TASK_MANAGER_NATIVE
+
+  #include <Print.h>
+  #include <esp32-hal-log.h>
+  #include <esp_task_wdt.h>
+  #include <esp_timer.h>
+  #include <freertos/FreeRTOS.h>
+  #include <freertos/task.h>
+
+#else
+
+  #include <assert.h>
+  #include <inttypes.h>
+  #include <stdarg.h>
+  #include <stddef.h>
+  #include <stdint.h>
+  #include <stdio.h>
+  #include <string.h>
+
+namespace Mycila {
+  // Deterministic clock of the native build, in microseconds.
+  // It starts at 1 second like a board which just booted: a time of 0 means "never ran" to the tasks.
+  class VirtualClock {
+    public:
+      static int64_t now() { return _now; }
+      static void set(int64_t us) { _now = us; }
+      static void advance(int64_t us) { _now += us; }
+
+    private:
+      static inline int64_t _now = 1000000;
+  };
+} // namespace Mycila
+
+// Arduino
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      size_t n = 0;
+      while (size--)
+        n += write(*buffer++);
+      return n;
+    }
+    size_t write(const char* str) { return str ? write(reinterpret_cast<const uint8_t*>(str), strlen(str)) : 0; }
+
+    size_t print(const char* str) { return write(str); }
+    size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+    size_t print(int n) { return print(static_cast<long long>(n)); }
+    size_t print(unsigned int n) { return print(static_cast<unsigned long long>(n)); }
+    size_t print(long n) { return print(static_cast<long long>(n)); } // NOLINT(runtime/int)
+    size_t print(unsigned long n) { return print(static_cast<unsigned long long>(n)); } // NOLINT(runtime/int)
+    size_t print(long long n) { return printf("%lld", n); } // NOLINT(runtime/int)
+    size_t print(unsigned long long n) { return printf("%llu", n); } // NOLINT(runtime/int)
+    size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+
+    size_t println() { return write("\r\n"); }
+    size_t println(const char* str) { return write(str) + println(); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+      char buffer[128];
+      va_list args;
+      va_start(args, format);
+      int len = vsnprintf(buffer, sizeof(buffer), format, args);
+      va_end(args);
+      if (len < 0)
+        return 0;
+      if (static_cast<size_t>(len) < sizeof(buffer))
+        return write(reinterpret_cast<const uint8_t*>(buffer), len);
+      char* big = new char[len + 1];
+      va_start(args, format);
+      vsnprintf(big, len + 1, format, args);
+      va_end(args);
+      size_t n = write(reinterpret_cast<const uint8_t*>(big), len);
+      delete[] big;
+      return n;
+    }
+};
+
+inline void yield() {}
+
+  #define ESP_LOGD(tag, format, ...) ((void)0)
+  #define ESP_LOGI(tag, format, ...) printf("[%s] " format "\n", tag, ##__VA_ARGS__)
+  #define ESP_LOGW(tag, format, ...) printf("[%s] " format "\n", tag, ##__VA_ARGS__)
+  #define ESP_LOGE(tag, format, ...) printf("[%s] " format "\n", tag, ##__VA_ARGS__)
+
+// ESP-IDF
+
+  #define IRAM_ATTR
+  #define ESP_OK                        0
+  #define ESP_FAIL                      -1
+  #define ESP_IDF_VERSION_MAJOR         5
+  #define SOC_CPU_CORES_NUM             1
+  #define CONFIG_ESP_TASK_WDT_TIMEOUT_S 5
+
+typedef int esp_err_t;
+
+inline int64_t esp_timer_get_time() { return Mycila::VirtualClock::now(); }
+
+// no timers: TaskManager::checkTimeouts() has to be called by the program
+typedef struct esp_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef enum {
+  ESP_TIMER_TASK
+} esp_timer_dispatch_t;
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t*, esp_timer_handle_t*) { return ESP_FAIL; }
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t, uint64_t) { return ESP_FAIL; }
+inline esp_err_t esp_timer_stop(esp_timer_handle_t) { return ESP_OK; }
+inline esp_err_t esp_timer_delete(esp_timer_handle_t) { return ESP_OK; }
+
+// FreeRTOS
+
+  #define pdFALSE                      0
+  #define pdTRUE                       1
+  #define pdPASS                       1
+  #define pdFAIL                       0
+  #define portMAX_DELAY                0xffffffffUL
+  #define portTICK_PERIOD_MS           1
+  #define portNUM_PROCESSORS           1
+  #define tskNO_AFFINITY               0x7FFFFFFF
+  #define portMUX_INITIALIZER_UNLOCKED {0}
+  #define portENTER_CRITICAL(mux)      ((void)(mux))
+  #define portEXIT_CRITICAL(mux)       ((void)(mux))
+  #define portYIELD_FROM_ISR()         ((void)0)
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef struct tskTaskControlBlock* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+typedef struct {
+    uint32_t owner;
+} portMUX_TYPE;
+
+inline BaseType_t xTaskCreateUniversal(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t* handle, BaseType_t) {
+  *handle = nullptr;
+  return pdFAIL;
+}
+inline void vTaskDelete(TaskHandle_t) {}
+inline void vTaskDelay(TickType_t) {}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return nullptr; }
+inline UBaseType_t uxTaskPriorityGet(TaskHandle_t) { return 1; }
+inline BaseType_t xPortGetCoreID() { return 0; }
+inline BaseType_t xTaskNotifyGive(TaskHandle_t) { return pdPASS; }
+inline void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t*) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+
+// Task watchdog
+
+typedef struct {
+    uint32_t timeout_ms;
+    uint32_t idle_core_mask;
+    bool trigger_panic;
+} esp_task_wdt_config_t;
+
+inline esp_err_t esp_task_wdt_init(const esp_task_wdt_config_t*) { return ESP_OK; }
+inline esp_err_t esp_task_wdt_reconfigure(const esp_task_wdt_config_t*) { return ESP_OK; }
+inline esp_err_t esp_task_wdt_add(TaskHandle_t) { return ESP_FAIL; }
+inline esp_err_t esp_task_wdt_delete(TaskHandle_t) { return ESP_FAIL; }
+inline esp_err_t esp_task_wdt_reset() { return ESP_OK; }
+
+#endif